@@ -0,0 +1,105 @@
+#include "common.h"
+
+#include <stdint.h>
+
+// With ALLOC_WRAP the linker routes every malloc family call, including those made by the AmiUtil
+// containers, through the wrappers below. Each block carries its size in a header so that growth
+// and the live heap can be measured without help from the C library. The wrappers only ever call
+// __real_malloc and __real_free, since the C library's own calloc and realloc may be built on malloc
+// and free, and the wrap would then route those inner calls back here.
+typedef union {
+    size_t size;
+    long long align_long;
+    double align_double;
+    void* align_pointer;
+} AllocHeader;
+
+static struct {
+    AllocCounts counts[SS_Count + 1];
+    size_t live_bytes;
+    size_t peak_bytes;
+} g;
+
+const AllocCounts* alloc_counts(StatsStage stage) {
+    return &g.counts[stage];
+}
+
+size_t alloc_peak(void) {
+    return g.peak_bytes;
+}
+
+#ifdef ALLOC_WRAP
+
+void __real_free(void* block);
+void* __real_malloc(size_t size);
+
+static void* track_block(AllocHeader* header, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    ++ g.counts[stats_stage()].allocs;
+
+    return track_block(__real_malloc(sizeof(AllocHeader) + size), size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    if (size && (count > SIZE_MAX / size)) {
+        return NULL;
+    }
+
+    void* block = __wrap_malloc(count * size);
+
+    if (block) {
+        memset(block, 0, count * size);
+    }
+
+    return block;
+}
+
+void* __wrap_realloc(void* block, size_t size) {
+    if (! block) {
+        return __wrap_malloc(size);
+    }
+
+    AllocHeader* old_header = (AllocHeader*)block - 1;
+    size_t old_size = old_header->size;
+    AllocCounts* counts = &g.counts[stats_stage()];
+    AllocHeader* new_header = __real_malloc(sizeof(AllocHeader) + size);
+
+    if (! new_header) {
+        return NULL;
+    }
+
+    // Every resize copies the contents, which is the cost that repeated growth hides. A C library
+    // realloc can sometimes grow in place, so this counts the worst case.
+    ++ counts->reallocs;
+    counts->bytes_copied += MIN(old_size, size);
+    memcpy(new_header + 1, block, MIN(old_size, size));
+
+    g.live_bytes -= old_size;
+    __real_free(old_header);
+
+    return track_block(new_header, size);
+}
+
+void __wrap_free(void* block) {
+    if (block) {
+        AllocHeader* header = (AllocHeader*)block - 1;
+
+        g.live_bytes -= header->size;
+        __real_free(header);
+    }
+}
+
+static void* track_block(AllocHeader* header, size_t size) {
+    if (! header) {
+        return NULL;
+    }
+
+    header->size = size;
+    g.live_bytes += size;
+    g.peak_bytes = MAX(g.peak_bytes, g.live_bytes);
+
+    return header + 1;
+}
+
+#endif
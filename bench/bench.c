@@ -0,0 +1,250 @@
+#include "bench.h"
+
+#include <getopt.h>
+
+#define MAX_SIZES 8
+
+typedef struct {
+    const char* work_path;
+    uint sizes[MAX_SIZES];
+    uint size_count;
+    uint repeats;
+    bool micro;
+    SiteOptions site_options;
+} Arguments;
+
+static Status args_parse(Arguments* args, int argc, char *argv[]);
+static Status bench_all(double* elapsed_ms_p, const char* site_path);
+static Status bench_one(double* elapsed_ms_p, const char* site_path, const char* markdown_path, uint repeats);
+static Status bench_size(const Arguments* args, uint page_count);
+static Status parse_list(uint* values, uint* count_p, uint max_count, const char* text, const char* option);
+
+int main(int argc, char *argv[]) {
+    TRY
+    bool passed = true;
+    Arguments args = {
+        .sizes = {100, 10000, 100000},
+        .size_count = 3,
+        .repeats = 10,
+        .site_options = {
+            .depth = 4,
+            .page_size = 4096,
+            .images_per_page = 0,
+            .post_percent = 50,
+            .mix = {2, 3, 3, 1, 1},
+            .seed = 1,
+        },
+    };
+
+    memory_init();
+
+    CHECK(args_parse(&args, argc, argv));
+    CHECK(eclock_init());
+
+    if (args.micro) {
+        CHECK(micro_run(&passed, args.work_path));
+        THROW(StatusOK);
+    }
+
+    printf("%8s %10s %10s %12s %10s %12s\n", "Pages", "MB", "All ms", "Pages/sec", "MB/sec", "One page ms");
+
+    for (uint size = 0; size < args.size_count; ++ size) {
+        CHECK(bench_size(&args, args.sizes[size]));
+    }
+
+    FINALLY
+    eclock_fini();
+
+    return passed ? 0 : EXIT_FAILURE;
+}
+
+static Status bench_size(const Arguments* args, uint page_count) {
+    TRY
+    char* site_path = NULL;
+    char dir_name[24];
+    SiteOptions site_options = args->site_options;
+    SiteResult result = {0};
+    double all_ms = 0.0;
+    double one_ms = 0.0;
+
+    site_options.page_count = page_count;
+    sprintf(dir_name, "site-%u", page_count);
+
+    CHECK(string_path_join(&site_path, args->work_path, dir_name));
+    CHECK(sitegen_write(site_path, &site_options, &result));
+
+    CHECK(bench_all(&all_ms, site_path));
+    CHECK(bench_one(&one_ms, site_path, result.deep_page_path, args->repeats));
+
+    double megabytes = result.markdown_bytes / (1024.0 * 1024.0);
+    double seconds = MAX(all_ms, 0.001) / 1000.0;
+
+    printf("%8u %10.2f %10.1f %12.1f %10.2f %12.2f\n", page_count, megabytes, all_ms, page_count / seconds,
+        megabytes / seconds, one_ms);
+
+    FINALLY
+    string_free(&result.deep_page_path);
+    string_free(&site_path);
+
+    RETURN;
+}
+
+static Status bench_all(double* elapsed_ms_p, const char* site_path) {
+    TRY
+    BuildOptions build_options = {0};
+    BuildResult result = {0};
+    Output output = {0};
+    Site site = {0};
+
+    site.output = &output;
+
+    CHECK(site_init(&site, site_path, NULL));
+    CHECK(output_init(&output, NULL, site_path));
+
+    Ticks start = eclock_read();
+
+    CHECK(page_build_all(&result, &site, &build_options));
+    CHECK(output_close(&output));
+
+    *elapsed_ms_p = eclock_to_ms(eclock_read() - start);
+
+    FINALLY
+    output_fini(&output);
+    site_fini(&site);
+
+    RETURN;
+}
+
+// Rebuilds the deepest page as --live would, averaged over several runs.
+static Status bench_one(double* elapsed_ms_p, const char* site_path, const char* markdown_path, uint repeats) {
+    TRY
+    Ticks total = 0;
+    Output output = {0};
+    Site site = {0};
+
+    site.output = &output;
+
+    CHECK(site_init(&site, site_path, NULL));
+    CHECK(output_init(&output, NULL, site_path));
+
+    for (uint repeat = 0; repeat < repeats; ++ repeat) {
+        Ticks start = eclock_read();
+
+        CHECK(page_build_one(&site, markdown_path));
+        total += eclock_read() - start;
+
+        page_fini(&site);
+        CHECK(page_init(&site));
+    }
+
+    *elapsed_ms_p = eclock_to_ms(total) / MAX(1, repeats);
+
+    FINALLY
+    output_fini(&output);
+    site_fini(&site);
+
+    RETURN;
+}
+
+static Status args_parse(Arguments* args, int argc, char *argv[]) {
+    TRY
+    uint mix_count = 0;
+    uint seed = 0;
+
+    struct option long_opts[] = {
+        {"depth",     required_argument, NULL, 'd'},
+        {"help",      no_argument,       NULL, 'h'},
+        {"images",    required_argument, NULL, 'i'},
+        {"micro",     no_argument,       NULL, 'M'},
+        {"mix",       required_argument, NULL, 'm'},
+        {"pages",     required_argument, NULL, 'n'},
+        {"posts",     required_argument, NULL, 'p'},
+        {"repeats",   required_argument, NULL, 'r'},
+        {"page-size", required_argument, NULL, 's'},
+        {"seed",      required_argument, NULL, 'S'},
+        {"workdir",   required_argument, NULL, 'w'},
+        {NULL,        0,                 NULL, 0  }
+    };
+
+    for (int short_opt; (short_opt = getopt_long(argc, argv, "d:hi:Mm:n:p:r:s:S:w:", long_opts, NULL)) != -1;) {
+        switch (short_opt) {
+        case 'd':
+            CHECK(parse_count(&args->site_options.depth, optarg, "--depth"));
+            break;
+        case 'i':
+            CHECK(parse_count(&args->site_options.images_per_page, optarg, "--images"));
+            break;
+        case 'm':
+            CHECK(parse_list(args->site_options.mix, &mix_count, SM_Count, optarg, "--mix"));
+            ASSERT(mix_count == SM_Count, "Option --mix requires %u weights", SM_Count);
+            break;
+        case 'M':
+            args->micro = true;
+            break;
+        case 'n':
+            CHECK(parse_list(args->sizes, &args->size_count, MAX_SIZES, optarg, "--pages"));
+            break;
+        case 'p':
+            CHECK(parse_count(&args->site_options.post_percent, optarg, "--posts"));
+            ASSERT(args->site_options.post_percent <= 100, "Option --posts is a percentage");
+            break;
+        case 'r':
+            CHECK(parse_count(&args->repeats, optarg, "--repeats"));
+            break;
+        case 's':
+            CHECK(parse_count(&args->site_options.page_size, optarg, "--page-size"));
+            break;
+        case 'S':
+            CHECK(parse_count(&seed, optarg, "--seed"));
+            args->site_options.seed = seed;
+            break;
+        case 'w':
+            args->work_path = optarg;
+            break;
+        case 'h':
+            fprintf(stderr, "Usage: AGPBench -w WORKDIR [OPTION]...\n\n");
+            fprintf(stderr, "  -d, --depth      Nesting depth of non-post pages (4)\n");
+            fprintf(stderr, "  -h, --help       Show this help message\n");
+            fprintf(stderr, "  -i, --images     Images per page (0)\n");
+            fprintf(stderr, "  -M, --micro      Run parser and renderer scaling checks instead\n");
+            fprintf(stderr, "  -m, --mix        Weights of lists,links,bold,code,escapes blocks (2,3,3,1,1)\n");
+            fprintf(stderr, "  -n, --pages      Comma-separated site sizes (100,10000,100000)\n");
+            fprintf(stderr, "  -p, --posts      Percentage of pages that are posts (50)\n");
+            fprintf(stderr, "  -r, --repeats    Single-page rebuilds to average (10)\n");
+            fprintf(stderr, "  -s, --page-size  Approximate bytes of markdown per page (4096)\n");
+            fprintf(stderr, "  -S, --seed       Generator seed (1)\n");
+            fprintf(stderr, "  -w, --workdir    Directory to generate sites in\n");
+        case ':':
+        case '?':
+            THROW(StatusQuit);
+        }
+    }
+
+    ASSERT(args->work_path, "Option --workdir is required");
+
+    FINALLY RETURN;
+}
+
+static Status parse_list(uint* values, uint* count_p, uint max_count, const char* text, const char* option) {
+    TRY
+    const char* next_char = text;
+
+    for (*count_p = 0; *count_p < max_count; ++ *count_p) {
+        char* text_end = NULL;
+
+        values[*count_p] = strtoul(next_char, &text_end, 10);
+        ASSERT((text_end != next_char) && ((*text_end == '\0') || (*text_end == ',')),
+            "Option %s requires a number", option);
+
+        next_char = text_end + 1;
+
+        if (*text_end == '\0') {
+            ++ *count_p;
+            break;
+        }
+    }
+
+    ASSERT(next_char[-1] == '\0', "Option %s accepts at most %u numbers", option, max_count);
+
+    FINALLY RETURN;
+}
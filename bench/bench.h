@@ -0,0 +1,34 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../common.h"
+
+typedef enum {
+    SM_List,
+    SM_Link,
+    SM_Bold,
+    SM_Code,
+    SM_Escape,
+    SM_Count,
+} SiteMix;
+
+typedef struct {
+    uint page_count;
+    uint depth;
+    uint page_size;
+    uint images_per_page;
+    uint post_percent;
+    uint mix[SM_Count];
+    uint seed;
+} SiteOptions;
+
+typedef struct {
+    size_t markdown_bytes;
+    char* deep_page_path;
+} SiteResult;
+
+Status micro_run(bool* passed_p, const char* work_path);
+Status sitegen_write(const char* site_path, const SiteOptions* options, SiteResult* result);
+Status sitegen_write_template(const char* site_path);
+
+#endif
@@ -0,0 +1,224 @@
+#include "bench.h"
+
+#define MIN_SAMPLE_MS 20.0
+#define MAX_SAMPLE_REPEATS 1000
+#define DOUBLING_LIMIT 2.5
+
+typedef Status (*MakeInput)(char** text_p, uint size);
+
+typedef struct {
+    const char* name;
+    MakeInput make_input;
+    uint start_size;
+    uint step_count;
+    bool deep;
+} MicroCase;
+
+static Status make_code(char** text_p, uint size);
+static Status make_deep(char** text_p, uint size);
+static Status make_escapes(char** text_p, uint size);
+static Status make_long_line(char** text_p, uint size);
+static Status make_open_bold(char** text_p, uint size);
+static Status make_open_link(char** text_p, uint size);
+static Status measure(double* parse_ms_p, double* render_ms_p, const MicroCase* micro_case, uint size);
+static Status repeat_text(char** text_p, const char* prefix, const char* unit, const char* suffix, uint size);
+static Status run_case(bool* passed_p, const MicroCase* micro_case);
+static Status sample_page(double* parse_ms_p, double* render_ms_p, Site* site, const char* text);
+
+static const MicroCase cases[] = {
+    {"long line",     make_long_line, 1024, 5, false},
+    {"escapes",       make_escapes,   1024, 5, false},
+    {"dense code",    make_code,      1024, 5, false},
+    {"open bold",     make_open_bold, 1024, 5, false},
+    {"open link",     make_open_link, 1024, 5, false},
+    {"deep ancestry", make_deep,      16,   5, true },
+};
+
+static struct {
+    const char* work_path;
+    Site site;
+} g;
+
+// Each case runs at doubling sizes. Linear work roughly doubles in time per step and quadratic
+// work quadruples, so allowing DOUBLING_LIMIT per step between the smallest and largest run
+// catches quadratic copying long before a real site is big enough to show it.
+Status micro_run(bool* passed_p, const char* work_path) {
+    TRY
+    g.work_path = work_path;
+    *passed_p = true;
+
+    CHECK(sitegen_write_template(work_path));
+    g.site.base_path = work_path;
+    CHECK(html_init(&g.site));
+    CHECK(cache_init(&g.site));
+
+    printf("%-14s %8s %12s %12s\n", "Case", "Size", "Parse ms", "Render ms");
+
+    for (uint index = 0; index < sizeof(cases) / sizeof(cases[0]); ++ index) {
+        bool passed = false;
+
+        CHECK(run_case(&passed, &cases[index]));
+        *passed_p = *passed_p && passed;
+    }
+
+    FINALLY
+    cache_fini(&g.site);
+    html_fini(&g.site);
+
+    RETURN;
+}
+
+static Status run_case(bool* passed_p, const MicroCase* micro_case) {
+    TRY
+    uint size = micro_case->start_size;
+    double first_parse_ms = 0.0;
+    double first_render_ms = 0.0;
+    double parse_ms = 0.0;
+    double render_ms = 0.0;
+
+    for (uint step = 0; step < micro_case->step_count; ++ step, size *= 2) {
+        CHECK(measure(&parse_ms, &render_ms, micro_case, size));
+        printf("%-14s %8u %12.3f %12.3f\n", micro_case->name, size, parse_ms, render_ms);
+
+        if (step == 0) {
+            first_parse_ms = parse_ms;
+            first_render_ms = render_ms;
+        }
+    }
+
+    double growth_limit = 1.0;
+
+    for (uint step = 1; step < micro_case->step_count; ++ step) {
+        growth_limit *= DOUBLING_LIMIT;
+    }
+
+    double parse_growth = MAX(parse_ms, 0.001) / MAX(first_parse_ms, 0.001);
+    double render_growth = MAX(render_ms, 0.001) / MAX(first_render_ms, 0.001);
+
+    *passed_p = (parse_growth <= growth_limit) && (render_growth <= growth_limit);
+
+    printf("%-14s %8s %11.1fx %11.1fx  %s (limit %.1fx)\n\n", micro_case->name, "growth", parse_growth,
+        render_growth, *passed_p ? "ok" : "SUPERLINEAR", growth_limit);
+
+    FINALLY RETURN;
+}
+
+// The measured page is last in the site's pages. For deep cases every other page is one of its ancestors,
+// rendered first so that their titles and breadcrumbs are memoized as in a real build.
+static Status measure(double* parse_ms_p, double* render_ms_p, const MicroCase* micro_case, uint size) {
+    TRY
+    char* text = NULL;
+    char* html = NULL;
+    uint ancestor_count = micro_case->deep ? size : 0;
+
+    CHECK(micro_case->make_input(&text, size));
+    CHECK(page_init(&g.site));
+
+    for (uint index = 0; index <= ancestor_count; ++ index) {
+        CHECK(vector_append(&g.site.pages, 1, NULL));
+        Page* page = &vector_last(g.site.pages);
+
+        page->parent_index = (index > 0) ? (index - 1) : PAGE_INDEX_NONE;
+        CHECK(string_clone(&page->dir_path, g.work_path));
+        CHECK(string_printf(&page->relative_url, "level%u/", index));
+
+        if (index < ancestor_count) {
+            CHECK(string_printf(&page->title, "Level %u", index));
+            CHECK(string_clone(&page->date, "2000-01-01"));
+            page->date_year = 2000;
+            page->date_month = 1;
+            page->date_day = 1;
+            CHECK(vector_new(&page->nodes, sizeof(Node), 0));
+            CHECK(html_generate(&html, &g.site, page));
+            string_free(&html);
+        }
+    }
+
+    CHECK(sample_page(parse_ms_p, render_ms_p, &g.site, text));
+
+    FINALLY
+    string_free(&html);
+    string_free(&text);
+    page_fini(&g.site);
+
+    RETURN;
+}
+
+static Status sample_page(double* parse_ms_p, double* render_ms_p, Site* site, const char* text) {
+    TRY
+    Page* page = &vector_last(site->pages);
+    char* html = NULL;
+    Ticks parse_ticks = 0;
+    Ticks render_ticks = 0;
+    uint repeats = 0;
+
+    while ((repeats < MAX_SAMPLE_REPEATS) && (eclock_to_ms(parse_ticks + render_ticks) < MIN_SAMPLE_MS)) {
+        CHECK(string_clone(&page->source, text));
+
+        Ticks start = eclock_read();
+
+        CHECK(vector_new(&page->nodes, sizeof(Node), 0));
+        CHECK(markdown_parse_all(page));
+
+        Ticks parsed = eclock_read();
+
+        CHECK(html_generate(&html, site, page));
+
+        Ticks rendered = eclock_read();
+
+        parse_ticks += parsed - start;
+        render_ticks += rendered - parsed;
+        ++ repeats;
+
+        string_free(&html);
+        page_free(page);
+        CHECK(string_clone(&page->dir_path, g.work_path));
+        CHECK(string_clone(&page->relative_url, "micro/"));
+    }
+
+    *parse_ms_p = eclock_to_ms(parse_ticks) / repeats;
+    *render_ms_p = eclock_to_ms(render_ticks) / repeats;
+
+    FINALLY
+    string_free(&html);
+
+    RETURN;
+}
+
+static Status make_long_line(char** text_p, uint size) {
+    return repeat_text(text_p, "", "word ", "\n", size);
+}
+
+static Status make_escapes(char** text_p, uint size) {
+    return repeat_text(text_p, "", "\\*", "\n", size);
+}
+
+static Status make_code(char** text_p, uint size) {
+    return repeat_text(text_p, "```\n", "<a && b>\n", "```\n", size);
+}
+
+static Status make_open_bold(char** text_p, uint size) {
+    return repeat_text(text_p, "**", "word ", "\n", size);
+}
+
+static Status make_open_link(char** text_p, uint size) {
+    return repeat_text(text_p, "[", "word ", "\n", size);
+}
+
+static Status make_deep(char** text_p, uint size) {
+    return repeat_text(text_p, "", "word ", "\n", 64);
+}
+
+static Status repeat_text(char** text_p, const char* prefix, const char* unit, const char* suffix, uint size) {
+    TRY
+    CHECK(string_clone(text_p, "---\nTitle: Micro\nDate: 2000-01-01\n---\n"));
+    CHECK(string_append(text_p, prefix));
+
+    for (uint length = 0; length < size; length += strlen(unit)) {
+        CHECK(string_append(text_p, unit));
+    }
+
+    CHECK(string_append(text_p, suffix));
+
+    FINALLY RETURN;
+}
@@ -0,0 +1,328 @@
+#include "bench.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define MAX_DEPTH 32
+#define MAX_FANOUT 100000
+
+static Status append_block(char** text_p);
+static Status append_words(char** text_p, uint count);
+static Status make_dir(const char* path);
+static Status make_node_path(char** path_p, const char* site_path, uint node, uint fanout);
+static uint next_random(uint limit);
+static uint pick_fanout(uint node_count, uint depth);
+static Status write_images(const char* dir_path, char** text_p, uint image_count);
+static Status write_page(const char* dir_path, uint page_number, bool is_post, bool is_project,
+    const SiteOptions* options, SiteResult* result);
+
+static const char* words[] = {
+    "amiga", "blitter", "copper", "sprite", "bitplane", "chip", "fast", "memory", "kickstart", "workbench",
+    "paula", "denise", "agnus", "floppy", "track", "sector", "modulo", "palette", "raster", "vertical",
+};
+
+static const char page_template[] =
+    "<html><head><title>$TITLE</title></head>\n"
+    "<body><table>\n"
+    "$BODY\n"
+    "</table></body></html>\n";
+
+// 16x8 one-plane ILBM, enough for the picture datatype to report a BitMapHeader.
+static const unsigned char iff_image[] = {
+    'F', 'O', 'R', 'M', 0, 0, 0, 70, 'I', 'L', 'B', 'M',
+    'B', 'M', 'H', 'D', 0, 0, 0, 20,
+    0, 16, 0, 8, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 0, 16, 0, 8,
+    'C', 'M', 'A', 'P', 0, 0, 0, 6, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff,
+    'B', 'O', 'D', 'Y', 0, 0, 0, 16,
+    0xaa, 0xaa, 0x55, 0x55, 0xaa, 0xaa, 0x55, 0x55, 0xaa, 0xaa, 0x55, 0x55, 0xaa, 0xaa, 0x55, 0x55,
+};
+
+static struct {
+    const SiteOptions* options;
+    uint random_state;
+    uint mix_total;
+    uint post_count;
+} g;
+
+// The same options and seed always produce the same tree, byte for byte. Posts live under posts/
+// and the remaining pages form a tree of the requested depth below BASEDIR.
+Status sitegen_write(const char* site_path, const SiteOptions* options, SiteResult* result) {
+    TRY
+    char* path = NULL;
+    uint post_count = (options->page_count * options->post_percent) / 100;
+    uint tree_count = options->page_count - post_count;
+    uint fanout = pick_fanout(tree_count, MAX(1, MIN(options->depth, MAX_DEPTH)));
+
+    g.options = options;
+    g.random_state = options->seed ? options->seed : 1;
+    g.mix_total = 0;
+    g.post_count = post_count;
+
+    for (uint mix = 0; mix < SM_Count; ++ mix) {
+        g.mix_total += options->mix[mix];
+    }
+
+    result->markdown_bytes = 0;
+    string_free(&result->deep_page_path);
+
+    CHECK(make_dir(site_path));
+    CHECK(sitegen_write_template(site_path));
+
+    CHECK(string_path_join(&path, site_path, "posts"));
+    CHECK(make_dir(path));
+    string_free(&path);
+
+    for (uint post = 0; post < post_count; ++ post) {
+        CHECK(string_printf(&path, "%s/posts/post%06u", site_path, post));
+        CHECK(make_dir(path));
+        CHECK(write_page(path, post, true, false, options, result));
+        string_free(&path);
+    }
+
+    // Tree nodes are numbered as in a heap, so each parent directory exists before its children.
+    for (uint node = 1; node <= tree_count; ++ node) {
+        CHECK(make_node_path(&path, site_path, node, fanout));
+        CHECK(make_dir(path));
+        CHECK(write_page(path, post_count + node, false, node <= fanout, options, result));
+        string_free(&path);
+    }
+
+    FINALLY
+    string_free(&path);
+
+    RETURN;
+}
+
+Status sitegen_write_template(const char* site_path) {
+    TRY
+    char* path = NULL;
+
+    CHECK(string_path_join(&path, site_path, "page.html"));
+    CHECK(file_write(page_template, path));
+
+    FINALLY
+    string_free(&path);
+
+    RETURN;
+}
+
+static uint pick_fanout(uint node_count, uint depth) {
+    for (uint fanout = 2; fanout < MAX_FANOUT; ++ fanout) {
+        unsigned long long level_count = 1;
+        unsigned long long total = 0;
+
+        for (uint level = 0; level < depth; ++ level) {
+            level_count *= fanout;
+            total += level_count;
+        }
+
+        if (total >= node_count) {
+            return fanout;
+        }
+    }
+
+    return MAX_FANOUT;
+}
+
+static Status make_node_path(char** path_p, const char* site_path, uint node, uint fanout) {
+    TRY
+    uint ancestors[MAX_DEPTH + 1];
+    uint ancestor_count = 0;
+
+    for (; node > 0; node = (node - 1) / fanout) {
+        ancestors[ancestor_count ++] = node;
+    }
+
+    CHECK(string_clone(path_p, site_path));
+
+    while (ancestor_count > 0) {
+        char dir_name[16];
+
+        sprintf(dir_name, "n%u", ancestors[-- ancestor_count]);
+        CHECK(string_path_append(path_p, dir_name));
+    }
+
+    FINALLY RETURN;
+}
+
+static Status write_page(const char* dir_path, uint page_number, bool is_post, bool is_project,
+    const SiteOptions* options, SiteResult* result)
+{
+    TRY
+    char* text = NULL;
+    char* path = NULL;
+
+    CHECK(string_printf(&text, "---\nTitle: %s %u\nDate: %04u-%02u-%02u\n", is_post ? "Post" : "Page", page_number,
+        1985 + (page_number / 336), ((page_number / 28) % 12) + 1, (page_number % 28) + 1));
+
+    if (is_project) {
+        CHECK(string_append(&text, "Description: "));
+        CHECK(append_words(&text, 8));
+        CHECK(string_append(&text, "\n"));
+    }
+
+    CHECK(string_append(&text, "---\n"));
+    CHECK(append_words(&text, 40));
+    CHECK(string_append(&text, "\n\n"));
+    CHECK(write_images(dir_path, &text, options->images_per_page));
+
+    while (string_length(text) < options->page_size) {
+        CHECK(append_block(&text));
+    }
+
+    CHECK(string_path_join(&path, dir_path, "index.md"));
+    CHECK(file_write(text, path));
+
+    result->markdown_bytes += string_length(text);
+
+    // The last tree page is the deepest one, which makes the slowest single-page rebuild.
+    if (! is_post || ! result->deep_page_path) {
+        SWAP(result->deep_page_path, path);
+    }
+
+    FINALLY
+    string_free(&path);
+    string_free(&text);
+
+    RETURN;
+}
+
+static Status write_images(const char* dir_path, char** text_p, uint image_count) {
+    TRY
+    char* text = NULL;
+    char* path = NULL;
+    FILE* file = NULL;
+
+    for (uint image = 0; image < image_count; ++ image) {
+        CHECK(string_printf(&text, "![Figure %u](image%u.iff)\n\n", image, image));
+        CHECK(string_append(text_p, text));
+        string_free(&text);
+
+        // The page links the full image and shows the half size one, and both must exist for
+        // --check-links and --output-archive.
+        for (uint half = 0; half < 2; ++ half) {
+            CHECK(string_printf(&text, half ? "image%u_half.iff" : "image%u.iff", image));
+            CHECK(string_path_join(&path, dir_path, text));
+            string_free(&text);
+
+            ASSERT(file = fopen(path, "wb"), "Error accessing file %s", path);
+            ASSERT(fwrite(iff_image, 1, sizeof(iff_image), file) == sizeof(iff_image), "Error accessing file %s",
+                path);
+            fclose(file);
+            file = NULL;
+            string_free(&path);
+        }
+    }
+
+    FINALLY
+    if (file) {
+        fclose(file);
+    }
+
+    string_free(&path);
+    string_free(&text);
+
+    RETURN;
+}
+
+static Status append_block(char** text_p) {
+    TRY
+    char* text = NULL;
+    uint mix = SM_Count;
+
+    // Blocks are chosen in proportion to the mix weights; with no weights every block is plain text.
+    if (g.mix_total > 0) {
+        uint pick = next_random(g.mix_total);
+
+        for (mix = 0; pick >= g.options->mix[mix]; ++ mix) {
+            pick -= g.options->mix[mix];
+        }
+    }
+
+    switch (mix) {
+    case SM_List:
+        for (uint item = 0; item < 4; ++ item) {
+            CHECK(string_append(text_p, "- "));
+            CHECK(append_words(text_p, 6));
+            CHECK(string_append(text_p, "\n"));
+        }
+        break;
+    case SM_Link: {
+        uint post = next_random(MAX(1, g.post_count));
+
+        CHECK(append_words(text_p, 12));
+        CHECK(string_printf(&text, " [see post %u](/posts/post%06u/) ", post, post));
+        CHECK(string_append(text_p, text));
+        CHECK(append_words(text_p, 12));
+        CHECK(string_append(text_p, "\n"));
+        break;
+    }
+    case SM_Bold:
+        CHECK(append_words(text_p, 12));
+        CHECK(string_append(text_p, " **"));
+        CHECK(append_words(text_p, 3));
+        CHECK(string_append(text_p, "** "));
+        CHECK(append_words(text_p, 12));
+        CHECK(string_append(text_p, "\n"));
+        break;
+    case SM_Code:
+        CHECK(string_append(text_p, "```\n"));
+
+        for (uint line = 0; line < 8; ++ line) {
+            CHECK(string_append(text_p, "    if (a < b && c < d) { move.l <ea>,d0 & mask }\n"));
+        }
+
+        CHECK(string_append(text_p, "```\n"));
+        break;
+    case SM_Escape:
+        CHECK(append_words(text_p, 6));
+        CHECK(string_append(text_p, " \\*not bold\\* \\[not a link\\] a < b & c \\\\ "));
+        CHECK(append_words(text_p, 6));
+        CHECK(string_append(text_p, "\n"));
+        break;
+    default:
+        CHECK(append_words(text_p, 30));
+        CHECK(string_append(text_p, "\n"));
+        break;
+    }
+
+    CHECK(string_append(text_p, "\n"));
+
+    FINALLY
+    string_free(&text);
+
+    RETURN;
+}
+
+static Status append_words(char** text_p, uint count) {
+    TRY
+    for (uint word = 0; word < count; ++ word) {
+        if (word > 0) {
+            CHECK(string_append(text_p, " "));
+        }
+
+        CHECK(string_append(text_p, words[next_random(sizeof(words) / sizeof(words[0]))]));
+    }
+
+    FINALLY RETURN;
+}
+
+static Status make_dir(const char* path) {
+    TRY
+    struct stat path_stat;
+
+    if (stat(path, &path_stat) != 0) {
+        ASSERT(mkdir(path, 0755) == 0, "Cannot create directory %s", path);
+    }
+
+    FINALLY RETURN;
+}
+
+// xorshift32: fast, and identical on every compiler, unlike rand().
+static uint next_random(uint limit) {
+    g.random_state ^= g.random_state << 13;
+    g.random_state ^= g.random_state >> 17;
+    g.random_state ^= g.random_state << 5;
+
+    return g.random_state % limit;
+}
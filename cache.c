@@ -0,0 +1,459 @@
+#include "common.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define ENTRY_MAGIC "AGP-BODY 3"
+#define LINE_SIZE 32
+#define NODES_MAGIC "AGP-NODES 1"
+#define SIZES_NAME "sizes"
+
+// Starts a nodes file, which is followed by node_count nodes as they are held in memory.
+typedef struct {
+    char magic[sizeof(NODES_MAGIC)];
+    uint node_size;
+    uint node_count;
+    uint source_length;
+} NodesHeader;
+
+static Status entry_path(char** entry_path_p, Site* site, Page* page, const char* markdown);
+static Status image_stamp(char** stamp_p, Page* page, const char* url);
+static Status load_body_sizes(Site* site);
+static Status nodes_path(char** nodes_path_p, Site* site, const char* markdown);
+static Status parse_entry(bool* valid_p, char** body_html_p, Page* page, const char* entry);
+
+// Each entry holds a page's rendered body and what the build needs from its content afterwards, its
+// summary, search terms and where the content lies in the body, in a file named by a hash of the
+// page's Markdown and its ancestors' titles and URLs. Entries also record the size and date of each
+// half-size image, as the body carries their dimensions. Sites without a cache path render every page.
+Status cache_init(Site* site) {
+    TRY
+    struct stat path_stat;
+
+    CHECK(hash_map_init(&site->body_sizes));
+
+    if (site->cache_path && (stat(site->cache_path, &path_stat) != 0)) {
+        ASSERT(mkdir(site->cache_path, 0755) == 0, "Cannot create directory %s", site->cache_path);
+    }
+
+    CHECK(load_body_sizes(site));
+
+    FINALLY RETURN;
+}
+
+void cache_fini(Site* site) {
+    hash_map_fini(&site->body_sizes);
+}
+
+// Other build state is kept alongside the entries in files named by the caller and a hash of the
+// site's base path, so that sites can share a cache directory. Leaves *path_p NULL for sites without
+// a cache.
+Status cache_file_path(char** path_p, Site* site, const char* name) {
+    TRY
+    if (site->cache_path) {
+        CHECK(string_printf(path_p, "%s/%s-%08lx", site->cache_path, name,
+            (unsigned long)(hash_string(HASH_SEED, site->base_path) & 0xFFFFFFFF)));
+    }
+
+    FINALLY RETURN;
+}
+
+// Leaves *body_html_p NULL when the page has to be rendered. On a hit the page's summary, search terms
+// and image URLs are filled in as rendering would have.
+Status cache_read(char** body_html_p, Site* site, Page* page, const char* markdown) {
+    TRY
+    char* path = NULL;
+    char* entry = NULL;
+    struct stat path_stat;
+    bool valid = false;
+
+    if (! site->cache_path) {
+        THROW(StatusOK);
+    }
+
+    CHECK(entry_path(&path, site, page, markdown));
+
+    if (stat(path, &path_stat) != 0) {
+        THROW(StatusOK);
+    }
+
+    CHECK(file_read(&entry, path));
+    CHECK(parse_entry(&valid, body_html_p, page, entry));
+
+    if (valid) {
+        stats_count(SC_BodiesCached, 1);
+        CHECK(hash_map_insert(&site->body_sizes, page->relative_url, string_length(*body_html_p)));
+    }
+
+    FINALLY
+    string_free(&entry);
+    string_free(&path);
+
+    RETURN;
+}
+
+Status cache_write(const char* body_html, Site* site, Page* page, const char* markdown) {
+    TRY
+    char* path = NULL;
+    char* entry = NULL;
+    char* stamp = NULL;
+
+    if (! site->cache_path) {
+        THROW(StatusOK);
+    }
+
+    size_t summary_length = page->summary ? string_length(page->summary) : 0;
+    size_t terms_length = page->terms ? string_length(page->terms) : 0;
+
+    CHECK(entry_path(&path, site, page, markdown));
+    CHECK(string_printf(&entry, ENTRY_MAGIC " %lu %lu %lu %lu %lu\n", (unsigned long)summary_length,
+        (unsigned long)terms_length, (unsigned long)vector_length(page->image_urls),
+        (unsigned long)page->content_offset, (unsigned long)page->content_length));
+
+    vector_foreach(page->image_urls, char*, url_p) {
+        CHECK(image_stamp(&stamp, page, *url_p));
+        CHECK(string_append(&entry, stamp));
+        CHECK(string_append(&entry, " "));
+        CHECK(string_append(&entry, *url_p));
+        CHECK(string_append(&entry, "\n"));
+        string_free(&stamp);
+    }
+
+    if (page->summary) {
+        CHECK(string_append(&entry, page->summary));
+    }
+
+    if (page->terms) {
+        CHECK(string_append(&entry, page->terms));
+    }
+
+    CHECK(string_append(&entry, body_html));
+    CHECK(file_write(entry, path));
+
+    FINALLY
+    string_free(&stamp);
+    string_free(&entry);
+    string_free(&path);
+
+    RETURN;
+}
+
+// A page's nodes refer to its Markdown by offset and hold no pointers, so they are kept as they are,
+// in a file named by a hash of the Markdown alone. A page whose body cannot be reused, say after an
+// ancestor's title changed, is then rendered without being parsed again. The nodes are read straight
+// into the page's vector, and page->nodes is left NULL unless the file holds exactly the nodes its
+// header counts, each of a known kind and type and lying within the Markdown, with every element
+// closed in turn. A file from another build or a damaged one means parsing as usual.
+Status cache_read_nodes(Site* site, Page* page) {
+    TRY
+    char* path = NULL;
+    FILE* file = NULL;
+    Node* nodes = NULL;
+    NodesHeader header;
+    size_t source_length = strlen(page->source);
+    long file_size = 0;
+    uint depth = 0;
+
+    if (! site->cache_path) {
+        THROW(StatusOK);
+    }
+
+    CHECK(nodes_path(&path, site, page->source));
+
+    if ((! (file = fopen(path, "rb"))) || (fread(&header, sizeof(header), 1, file) != 1) ||
+        (memcmp(header.magic, NODES_MAGIC, sizeof(header.magic)) != 0) || (header.node_size != sizeof(Node)) ||
+        (header.source_length != source_length))
+    {
+        THROW(StatusOK);
+    }
+
+    // The count is checked against the file's size before anything is allocated for it.
+    if ((fseek(file, 0, SEEK_END) != 0) || ((file_size = ftell(file)) < (long)sizeof(header)) ||
+        ((file_size - sizeof(header)) % sizeof(Node) != 0) ||
+        ((file_size - sizeof(header)) / sizeof(Node) != header.node_count) || (fseek(file, sizeof(header), SEEK_SET) != 0))
+    {
+        THROW(StatusOK);
+    }
+
+    CHECK(vector_new(&nodes, sizeof(Node), header.node_count));
+
+    if (fread(nodes, sizeof(Node), header.node_count, file) != header.node_count) {
+        THROW(StatusOK);
+    }
+
+    vector_foreach(nodes, Node, node) {
+        if ((node->kind > NK_Close) || (node->type > ET_Text) ||
+            (node->text_offset + (size_t)node->text_length > source_length) ||
+            (node->url_offset + (size_t)node->url_length > source_length) ||
+            ((node->kind == NK_Close) && (depth == 0)))
+        {
+            THROW(StatusOK);
+        }
+
+        if (node->kind == NK_Open) {
+            ++ depth;
+        } else if (node->kind == NK_Close) {
+            -- depth;
+        }
+    }
+
+    if (depth != 0) {
+        THROW(StatusOK);
+    }
+
+    stats_count(SC_BytesRead, sizeof(header) + header.node_count * sizeof(Node));
+    stats_count(SC_NodesCached, 1);
+    SWAP(page->nodes, nodes);
+
+    FINALLY
+    if (nodes) {
+        vector_free(&nodes);
+    }
+
+    if (file) {
+        fclose(file);
+    }
+
+    string_free(&path);
+
+    RETURN;
+}
+
+Status cache_write_nodes(Site* site, Page* page) {
+    TRY
+    char* path = NULL;
+    FILE* file = NULL;
+    NodesHeader header = {NODES_MAGIC, sizeof(Node), vector_length(page->nodes), strlen(page->source)};
+
+    if (! site->cache_path) {
+        THROW(StatusOK);
+    }
+
+    CHECK(nodes_path(&path, site, page->source));
+    ASSERT(file = fopen(path, "wb"), "Error accessing file %s", path);
+    ASSERT((fwrite(&header, sizeof(header), 1, file) == 1) &&
+        (fwrite(page->nodes, sizeof(Node), header.node_count, file) == header.node_count),
+        "Error accessing file %s", path);
+
+    FINALLY
+    if (file) {
+        fclose(file);
+    }
+
+    string_free(&path);
+
+    RETURN;
+}
+
+// Keeps the size of each page's body, as last rendered or read from its entry, for the next build to
+// size its buffers by. Pages no longer in the site are dropped.
+Status cache_write_sizes(Site* site) {
+    TRY
+    char* path = NULL;
+    char* sizes = NULL;
+    char line[LINE_SIZE];
+
+    CHECK(cache_file_path(&path, site, SIZES_NAME));
+
+    if (! path) {
+        THROW(StatusOK);
+    }
+
+    CHECK(string_new(&sizes, 0));
+
+    vector_foreach(site->pages, Page, page) {
+        size_t body_size = hash_map_find(&site->body_sizes, page->relative_url);
+
+        if (body_size != HASH_NONE) {
+            sprintf(line, "%lu ", (unsigned long)body_size);
+            CHECK(string_append(&sizes, line));
+            CHECK(string_append(&sizes, page->relative_url));
+            CHECK(string_append(&sizes, "\n"));
+        }
+    }
+
+    CHECK(file_write(sizes, path));
+
+    FINALLY
+    string_free(&sizes);
+    string_free(&path);
+
+    RETURN;
+}
+
+// Entries that do not match their header or whose images have changed are treated as missing and
+// overwritten once the page is rendered again.
+static Status parse_entry(bool* valid_p, char** body_html_p, Page* page, const char* entry) {
+    TRY
+    char** image_urls = NULL;
+    char* stamp = NULL;
+    unsigned long summary_length = 0;
+    unsigned long terms_length = 0;
+    unsigned long image_count = 0;
+    unsigned long content_offset = 0;
+    unsigned long content_length = 0;
+    int header_length = 0;
+
+    *valid_p = false;
+
+    // The summary follows the image lines directly and may start with spaces, so the header's own
+    // newline is matched by hand.
+    if ((sscanf(entry, ENTRY_MAGIC " %lu %lu %lu %lu %lu%n", &summary_length, &terms_length, &image_count,
+        &content_offset, &content_length, &header_length) < 5) || (entry[header_length] != '\n'))
+    {
+        THROW(StatusOK);
+    }
+
+    const char* next_char = &entry[header_length + 1];
+
+    CHECK(vector_new(&image_urls, sizeof(char*), 0));
+
+    for (unsigned long image = 0; image < image_count; ++ image) {
+        const char* url_start = strchr(next_char, ' ');
+        const char* url_end = url_start ? strchr(url_start, '\n') : NULL;
+
+        if (! url_end) {
+            THROW(StatusOK);
+        }
+
+        CHECK(vector_append(&image_urls, 1, NULL));
+        CHECK(string_clone_substr(&vector_last(image_urls), url_start + 1, url_end - url_start - 1));
+        CHECK(image_stamp(&stamp, page, vector_last(image_urls)));
+
+        if ((string_length(stamp) != url_start - next_char) || (strncmp(stamp, next_char, url_start - next_char) != 0)) {
+            THROW(StatusOK);
+        }
+
+        string_free(&stamp);
+        next_char = url_end + 1;
+    }
+
+    if (strlen(next_char) < summary_length + terms_length + content_offset + content_length) {
+        THROW(StatusOK);
+    }
+
+    if (! page->description) {
+        CHECK(string_clone_substr(&page->summary, next_char, summary_length));
+    }
+
+    CHECK(string_clone_substr(&page->terms, &next_char[summary_length], terms_length));
+    CHECK(string_clone(body_html_p, &next_char[summary_length + terms_length]));
+    SWAP(page->image_urls, image_urls);
+    page->content_offset = content_offset;
+    page->content_length = content_length;
+    *valid_p = true;
+
+    FINALLY
+    string_free(&stamp);
+
+    if (image_urls) {
+        vector_foreach(image_urls, char*, url_p) {
+            string_free(url_p);
+        }
+
+        vector_free(&image_urls);
+    }
+
+    RETURN;
+}
+
+// Each line of the sizes file is a body size, a space and the page's relative URL. Lines that do not
+// parse are skipped, and html_generate_body checks each size against the page before using it.
+static Status load_body_sizes(Site* site) {
+    TRY
+    char* path = NULL;
+    char* sizes = NULL;
+    struct stat path_stat;
+
+    CHECK(cache_file_path(&path, site, SIZES_NAME));
+
+    if ((! path) || (stat(path, &path_stat) != 0)) {
+        THROW(StatusOK);
+    }
+
+    CHECK(file_read(&sizes, path));
+
+    for (char* line = sizes; *line;) {
+        char* line_end = strchr(line, '\n');
+        char* url = NULL;
+        unsigned long body_size = 0;
+
+        if (! line_end) {
+            break;
+        }
+
+        *line_end = '\0';
+        errno = 0;
+        body_size = strtoul(line, &url, 10);
+
+        if ((url > line) && (*url == ' ') && (errno != ERANGE) && (body_size < HASH_NONE)) {
+            CHECK(hash_map_insert(&site->body_sizes, url + 1, body_size));
+        }
+
+        line = line_end + 1;
+    }
+
+    FINALLY
+    string_free(&sizes);
+    string_free(&path);
+
+    RETURN;
+}
+
+static Status entry_path(char** entry_path_p, Site* site, Page* page, const char* markdown) {
+    TRY
+    Page* pages = site->pages;
+    Hash hash = hash_string(hash_string(HASH_SEED, ENTRY_MAGIC), RENDER_VERSION);
+
+    hash = hash_string(hash, markdown);
+    hash = hash_string(hash, page->relative_url);
+
+    // Entries written without search terms cannot serve a build that indexes them.
+    hash = hash_string(hash, site->search_index ? "terms" : "");
+
+    // The breadcrumb links every ancestor by title and URL.
+    for (size_t index = page->parent_index; index != PAGE_INDEX_NONE; index = pages[index].parent_index) {
+        hash = hash_string(hash, pages[index].title);
+        hash = hash_string(hash, pages[index].relative_url);
+    }
+
+    CHECK(string_printf(entry_path_p, "%s/%08lx%08lx", site->cache_path, (unsigned long)(hash >> 32),
+        (unsigned long)(hash & 0xFFFFFFFF)));
+
+    FINALLY RETURN;
+}
+
+static Status nodes_path(char** nodes_path_p, Site* site, const char* markdown) {
+    TRY
+    Hash hash = hash_string(hash_string(hash_string(HASH_SEED, NODES_MAGIC), RENDER_VERSION), markdown);
+
+    CHECK(string_printf(nodes_path_p, "%s/%08lx%08lx.nodes", site->cache_path, (unsigned long)(hash >> 32),
+        (unsigned long)(hash & 0xFFFFFFFF)));
+
+    FINALLY RETURN;
+}
+
+static Status image_stamp(char** stamp_p, Page* page, const char* url) {
+    TRY
+    char* half_file_name = NULL;
+    char* image_path = NULL;
+    struct stat image_stat = {0};
+
+    CHECK(make_half_file_name(&half_file_name, url));
+    CHECK(string_path_join(&image_path, page->dir_path, half_file_name));
+
+    // A missing image gives a stamp no entry was written with, so the page is rendered and reports it.
+    if (stat(image_path, &image_stat) != 0) {
+        image_stat.st_mtime = 0;
+        image_stat.st_size = -1;
+    }
+
+    CHECK(string_printf(stamp_p, "%lu,%ld", (unsigned long)image_stat.st_mtime, (long)image_stat.st_size));
+
+    FINALLY
+    string_free(&image_path);
+    string_free(&half_file_name);
+
+    RETURN;
+}
@@ -1,11 +1,17 @@
 #include "common.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <proto/dos.h>
+
 #define ASSERT_FILE(EXPR) ASSERT(EXPR, "Error accessing file %s", path)
 
 Status file_read(char** contents_p, const char* path) {
     TRY
     FILE* file = NULL;
 
+    stats_begin(SS_Read);
+
     ASSERT_FILE(file = fopen(path, "r"));
     ASSERT_FILE(fseek(file, 0, SEEK_END) == 0);
 
@@ -15,12 +21,32 @@ Status file_read(char** contents_p, const char* path) {
 
     rewind(file);
     ASSERT_FILE(fread(*contents_p, 1, file_size, file) == file_size);
+    stats_count(SC_BytesRead, file_size);
 
     FINALLY
     if (file) {
         fclose(file);
     }
 
+    stats_end();
+
+    RETURN;
+}
+
+// The full path of a file, its volume included, which is the same however the file was reached.
+Status file_real_path(char** real_path_p, const char* path) {
+    TRY
+    BPTR lock = 0;
+
+    ASSERT(lock = Lock(path, ACCESS_READ));
+
+    CHECK(string_new(real_path_p, PATH_MAX));
+    ASSERT(NameFromLock(lock, *real_path_p, PATH_MAX));
+    CHECK(string_truncate(real_path_p, strlen(*real_path_p)));
+
+    FINALLY
+    UnLock(lock);
+
     RETURN;
 }
 
@@ -40,6 +66,46 @@ Status file_write(const char* contents, const char* path) {
     RETURN;
 }
 
+void json_write_string(FILE* file, const char* string) {
+    fputc('"', file);
+
+    for (const char* next_char = string; *next_char; ++ next_char) {
+        if ((*next_char == '"') || (*next_char == '\\')) {
+            fputc('\\', file);
+        }
+
+        fputc(*next_char, file);
+    }
+
+    fputc('"', file);
+}
+
+Status make_half_file_name(char** half_file_name_p, const char* file_name) {
+    TRY
+    CHECK(string_clone(half_file_name_p, file_name));
+    CHECK(string_replace_first(half_file_name_p, ".", "_half."));
+
+    FINALLY RETURN;
+}
+
+// Reads the value of a command line option that takes a number.
+Status parse_count(uint* count_p, const char* text, const char* option) {
+    TRY
+    // strtoul would skip leading spaces and quietly turn a minus sign into a huge count.
+    ASSERT((*text >= '0') && (*text <= '9'), "Option %s requires a number", option);
+
+    char* text_end = NULL;
+
+    errno = 0;
+    unsigned long count = strtoul(text, &text_end, 10);
+
+    ASSERT(*text_end == '\0', "Option %s requires a number", option);
+    ASSERT((errno != ERANGE) && (count <= UINT_MAX), "Option %s is out of range", option);
+    *count_p = count;
+
+    FINALLY RETURN;
+}
+
 Status string_append_indent(char** to_string_p, const char* suffix, uint indent) {
     TRY
     for (uint i = 0; i < indent; ++ i) {
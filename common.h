@@ -7,6 +7,60 @@ enum {
     StatusQuit = (1 << 1),
 };
 
+#define HASH_NONE ((size_t)-1)
+#define HASH_SEED 14695981039346656037ULL
+#define PAGE_INDEX_NONE ((size_t)-1)
+// Part of the name of every cached body and nodes file. Bump it with any change to the nodes
+// markdown.c produces or the HTML html.c makes of them, or older builds' files will be reused.
+#define RENDER_VERSION "2"
+#define TEMPLATE_PARTS 3
+
+typedef unsigned long long Hash;
+typedef unsigned long long Ticks;
+
+typedef enum {
+    SS_Walk,
+    SS_Read,
+    SS_Parse,
+    SS_Render,
+    SS_Images,
+    SS_Write,
+    SS_Root,
+    SS_Feed,
+    SS_Search,
+    SS_Count,
+} StatsStage;
+
+typedef enum {
+    SC_PagesBuilt,
+    SC_PagesScanned,
+    SC_BodiesCached,
+    SC_NodesCached,
+    SC_TagPagesBuilt,
+    SC_BytesRead,
+    SC_BytesWritten,
+    SC_Elements,
+    SC_Images,
+    SC_SearchBytes,
+    SC_Count,
+} StatsCounter;
+
+typedef struct {
+    size_t allocs;
+    size_t reallocs;
+    size_t bytes_copied;
+} AllocCounts;
+
+typedef struct {
+    char* key;
+    size_t value;
+} HashEntry;
+
+typedef struct {
+    HashEntry* entries;
+    size_t count;
+} HashMap;
+
 typedef enum {
     ET_None,
     ET_Bold,
@@ -21,42 +75,240 @@ typedef enum {
     ET_Text,
 } ElementType;
 
-typedef struct ElementS {
-    ElementType type;
-    struct ElementS* children;
-    char* text;
-    char* url;
-} Element;
+typedef enum {
+    NK_Open,
+    NK_Text,
+    NK_Close,
+} NodeKind;
+
+// A page's content is a flat run of nodes, each element an NK_Open and NK_Close pair around its
+// content. Text is held as offsets into the page's source, so nodes carry no pointers and can be
+// written out as they are. Text nodes of type ET_Preformatted are copied without escaping.
+typedef struct {
+    unsigned char kind;
+    unsigned char type;
+    unsigned short reserved;
+    uint text_offset;
+    uint text_length;
+    uint url_offset;
+    uint url_length;
+} Node;
+
+// The blocks left open at the end of one chunk of a page parsed in chunks.
+typedef struct {
+    uint open_token;
+    uint open_block;
+} MarkdownState;
 
 typedef struct PageS {
-    struct PageS* parent;
+    size_t parent_index;
     char* markdown_path;
     char* dir_path;
     char* relative_url;
     char* title;
     char* date;
     char* description;
-    Element* children;
+    char** tags;
+    char* full_title;
+    char* breadcrumb;
+    char* summary;
+    char* terms;
+    char* feed_html;
+    char** image_urls;
+    char* source;
+    Node* nodes;
+    uint content_offset;
+    uint content_length;
     uint date_year;
     uint date_month;
     uint date_day;
+    uint date_key;
     bool add_to_index;
 } Page;
 
+// Where a build writes its files: into BASEDIR, or into a tar file of it when archive is open. Images
+// already put in the tar file are kept in added_files.
+typedef struct {
+    FILE* archive;
+    const char* archive_path;
+    HashMap added_files;
+    const char* base_path;
+} Output;
+
+// A file written a piece at a time by output_begin, output_append and output_end.
+typedef struct {
+    FILE* file;
+    char* path;
+    size_t size;
+    long header_offset;
+} OutputFile;
+
+typedef struct {
+    uint index_post_count;
+    uint feed_item_count;
+    uint feed_content_size;
+    bool search_index;
+} BuildOptions;
+
+// What page_build_all built, for the caller to report.
+typedef struct {
+    uint page_count;
+    size_t search_index_size;
+    uint search_page_count;
+} BuildResult;
+
+typedef struct {
+    size_t* projects;
+    size_t* posts;
+    size_t* feed_items;
+} PageViews;
+
+typedef struct {
+    char* name;
+    char* slug;
+    size_t* page_indices;
+} Tag;
+
+typedef struct {
+    uint width;
+    uint height;
+    long file_size;
+    unsigned long file_time;
+} ImageSize;
+
+// Sizes of the half-size images probed so far, by path. One cache can serve several sites built
+// together, but never from more than one task at a time.
+typedef struct {
+    HashMap paths;
+    ImageSize* sizes;
+} ImageCache;
+
+// Everything needed to build or render one site. Sites share no state but the image cache and output
+// set by the caller, so a program embedding AGP can keep several and use each from its own task, giving
+// each task its own cache or none and its own output. Without an image cache, every image shown is
+// probed for its size. Only building writes files, so sites that only render need no output.
+typedef struct {
+    const char* base_path;
+    const char* cache_path;
+    char* template_parts[TEMPLATE_PARTS];
+    bool template_body_first;
+    bool template_has_title;
+    Page* pages;
+    size_t* feed_pages;
+    Tag* tags;
+    HashMap tag_map;
+    HashMap body_sizes;
+    ImageCache* image_cache;
+    Output* output;
+    uint feed_item_count;
+    uint feed_content_size;
+    bool scan_only;
+    bool search_index;
+} Site;
+
+const AllocCounts* alloc_counts(StatsStage stage);
+size_t alloc_peak(void);
+Status cache_file_path(char** path_p, Site* site, const char* name);
+void cache_fini(Site* site);
+Status cache_init(Site* site);
+Status cache_read(char** body_html_p, Site* site, Page* page, const char* markdown);
+Status cache_read_nodes(Site* site, Page* page);
+Status cache_write(const char* body_html, Site* site, Page* page, const char* markdown);
+Status cache_write_nodes(Site* site, Page* page);
+Status cache_write_sizes(Site* site);
+void eclock_fini(void);
+Status eclock_init(void);
+Ticks eclock_read(void);
+double eclock_to_ms(Ticks ticks);
 Status file_read(char** contents_p, const char* path);
+Status file_real_path(char** real_path_p, const char* path);
 Status file_write(const char* contents, const char* path);
-void html_fini(void);
-Status html_generate(char** page_html_p, Page* page);
-Status html_generate_root(char** root_html_p, Page* pages);
-Status html_init(const char* base_path);
-Status markdown_parse_all(const char* file_contents, Page* page);
-Status markdown_parse_frontmatter(const char* file_contents, Page* page);
-Status page_build_all(const char* base_path);
-Status page_build_live(const char* base_path);
-void page_fini(void);
-Status page_init(void);
+size_t hash_map_find(HashMap* map, const char* key);
+void hash_map_fini(HashMap* map);
+Status hash_map_init(HashMap* map);
+Status hash_map_insert(HashMap* map, const char* key, size_t value);
+Hash hash_string(Hash hash, const char* string);
+Status html_append_text(char** html_p, const char* text, size_t length, bool escape);
+void html_fini(Site* site);
+Status html_generate(char** page_html_p, Site* site, Page* page);
+Status html_generate_archive(char** archive_html_p, Site* site, size_t* post_indices, size_t post_count,
+    uint page_number, uint page_count);
+Status html_generate_body(char** body_html_p, Site* site, Page* page);
+Status html_generate_nodes(char** html_p, Site* site, Page* page, uint* indent_p);
+Status html_generate_page(char** page_html_p, Site* site, Page* page, const char* body_html);
+Status html_generate_page_end(char** html_p, Site* site, Page* page);
+Status html_generate_page_start(char** html_p, Site* site, Page* page, uint* indent_p);
+Status html_generate_root(char** root_html_p, Site* site, PageViews* views, size_t post_count, uint archive_page_count);
+Status html_generate_tag(char** tag_html_p, Site* site, Tag* tag);
+Status html_init(Site* site);
+void images_fini(ImageCache* cache);
+Status images_get_size(ImageSize* size_p, ImageCache* cache, const char* image_path);
+Status images_init(ImageCache* cache);
+void json_write_string(FILE* file, const char* string);
+Status links_check(Site* site);
+Status make_half_file_name(char** half_file_name_p, const char* file_name);
+Status markdown_parse_all(Page* page);
+Status markdown_parse_chunk(const char* content, Page* page, MarkdownState* state, bool is_last,
+    size_t* parsed_length_p);
+Status markdown_parse_content(const char* content, Page* page);
+Status markdown_parse_frontmatter(const char* file_contents, Page* page, const char** content_p);
+void memory_init(void);
+size_t memory_peak(void);
+void memory_sample(void);
+Status output_add_file(Output* output, const char* path);
+Status output_append(Output* output, OutputFile* output_file, const char* contents);
+Status output_begin(Output* output, OutputFile* output_file, const char* path);
+Status output_close(Output* output);
+Status output_end(Output* output, OutputFile* output_file);
+void output_fini(Output* output);
+void output_free(OutputFile* output_file);
+Status output_init(Output* output, const char* archive_path, const char* base_path);
+bool output_is_archive(Output* output);
+Status output_make_dir(Output* output, const char* path);
+Status output_remove_page(Output* output, const char* dir_path);
+Status output_write(Output* output, const char* contents, const char* path);
+Status output_write_changed(Output* output, const char* contents, const char* path);
+Status page_build_all(BuildResult* result, Site* site, const BuildOptions* options);
+Status page_build_live(Site* site);
+Status page_build_one(Site* site, const char* markdown_path);
+void page_fini(Site* site);
+void page_free(Page* page);
+Status page_init(Site* site);
+Status page_render(char** page_html_p, Site* site, Page* page);
+Status page_render_stdin(Site* site, const char* path);
+Status page_scan_all(Site* site);
+Status parse_count(uint* count_p, const char* text, const char* option);
 Status rexx_get_live_path(char** path_p);
-Status rss_generate(char** html_p, Page* pages);
+Status rss_generate(char** html_p, Page* pages, PageViews* views, uint item_count);
+Status search_make_terms(Page* page);
+Status search_write_index(BuildResult* result, Site* site);
+Status serve_run(Site* site, uint port);
+void site_fini(Site* site);
+Status site_init(Site* site, const char* base_path, const char* cache_path);
+Status site_render(char** page_html_p, Site* site, const char* markdown, const char* relative_url);
+void stats_begin(StatsStage stage);
+void stats_count(StatsCounter counter, size_t amount);
+void stats_end(void);
+void stats_fini(void);
+Status stats_init(bool enabled);
+void stats_page_begin(const char* path);
+Status stats_page_end(const char* path);
+Status stats_report(const char* json_path);
+StatsStage stats_stage(void);
 Status string_append_indent(char** to_string_p, const char* suffix, uint indent);
+Status tags_add_page(Site* site, size_t page_index);
+Status tags_build_pages(Site* site);
+void tags_fini(Site* site);
+Status tags_init(Site* site);
+Status tags_make_slug(char** slug_p, const char* name);
+void trace_begin(const char* name, const char* path);
+Status trace_close(void);
+void trace_end(void);
+void trace_fini(void);
+Status trace_init(const char* trace_path);
+Status views_build(PageViews* views, Page* pages);
+bool views_feed_precedes(Page* pages, size_t page_index1, size_t page_index2);
+void views_free(PageViews* views);
+Status views_sort_by_date(size_t* indices, Page* pages);
 
 #endif
@@ -0,0 +1,48 @@
+#include "common.h"
+
+#include <devices/timer.h>
+#include <proto/exec.h>
+#include <proto/timer.h>
+
+struct Device* TimerBase;
+
+// Shared by --stats and --trace, so the device is opened by whichever asks first.
+static struct {
+    bool open;
+    struct timerequest timer_request;
+    ULONG frequency;
+} g;
+
+Status eclock_init(void) {
+    TRY
+    if (! g.open) {
+        ASSERT(OpenDevice(TIMERNAME, UNIT_ECLOCK, (struct IORequest*)&g.timer_request, 0) == 0,
+            "Cannot open %s", TIMERNAME);
+
+        TimerBase = g.timer_request.tr_node.io_Device;
+        g.open = true;
+        eclock_read();
+    }
+
+    FINALLY RETURN;
+}
+
+void eclock_fini(void) {
+    if (g.open) {
+        CloseDevice((struct IORequest*)&g.timer_request);
+        TimerBase = NULL;
+        g.open = false;
+    }
+}
+
+Ticks eclock_read(void) {
+    struct EClockVal eclock;
+
+    g.frequency = ReadEClock(&eclock);
+
+    return ((Ticks)eclock.ev_hi << 32) | eclock.ev_lo;
+}
+
+double eclock_to_ms(Ticks ticks) {
+    return g.frequency ? ((ticks * 1000.0) / g.frequency) : 0.0;
+}
@@ -0,0 +1,110 @@
+#include "common.h"
+
+#define FNV_PRIME 1099511628211ULL
+#define MAP_MIN_CAPACITY 16
+
+static HashEntry* find_entry(HashMap* map, const char* key);
+static Status grow(HashMap* map);
+
+// FNV-1a, with the terminator hashed as well so that adjacent strings cannot run together.
+Hash hash_string(Hash hash, const char* string) {
+    const char* next_char = string ? string : "";
+
+    do {
+        hash = (hash ^ (unsigned char)*next_char) * FNV_PRIME;
+    } while (*(next_char ++));
+
+    return hash;
+}
+
+// Maps are open addressed with linear probing and grow to stay at most half full, so a lookup
+// touches a few neighbouring entries whatever the number of keys. Keys are copied into the map.
+Status hash_map_init(HashMap* map) {
+    TRY
+    map->count = 0;
+
+    CHECK(vector_new(&map->entries, sizeof(HashEntry), 0));
+    CHECK(vector_append(&map->entries, MAP_MIN_CAPACITY, NULL));
+
+    FINALLY RETURN;
+}
+
+void hash_map_fini(HashMap* map) {
+    if (map->entries) {
+        vector_foreach(map->entries, HashEntry, entry) {
+            string_free(&entry->key);
+        }
+
+        vector_free(&map->entries);
+    }
+
+    map->count = 0;
+}
+
+// Returns HASH_NONE for keys not in the map.
+size_t hash_map_find(HashMap* map, const char* key) {
+    HashEntry* entry = find_entry(map, key);
+
+    return entry->key ? entry->value : HASH_NONE;
+}
+
+// Replaces the value of a key already in the map.
+Status hash_map_insert(HashMap* map, const char* key, size_t value) {
+    TRY
+    if ((map->count + 1) * 2 > vector_length(map->entries)) {
+        CHECK(grow(map));
+    }
+
+    HashEntry* entry = find_entry(map, key);
+
+    if (! entry->key) {
+        CHECK(string_clone(&entry->key, key));
+        ++ map->count;
+    }
+
+    entry->value = value;
+
+    FINALLY RETURN;
+}
+
+// The entry holding key, or the empty one where it would go.
+static HashEntry* find_entry(HashMap* map, const char* key) {
+    size_t mask = vector_length(map->entries) - 1;
+    size_t slot = (size_t)hash_string(HASH_SEED, key) & mask;
+
+    while (map->entries[slot].key && (strcmp(map->entries[slot].key, key) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return &map->entries[slot];
+}
+
+static Status grow(HashMap* map) {
+    TRY
+    HashEntry* old_entries = map->entries;
+    HashEntry* new_entries = NULL;
+
+    CHECK(vector_new(&new_entries, sizeof(HashEntry), 0));
+    CHECK(vector_append(&new_entries, vector_length(old_entries) * 2, NULL));
+    map->entries = new_entries;
+    new_entries = NULL;
+
+    // Keys move to their new entries rather than being copied again.
+    vector_foreach(old_entries, HashEntry, old_entry) {
+        if (old_entry->key) {
+            HashEntry* entry = find_entry(map, old_entry->key);
+
+            SWAP(entry->key, old_entry->key);
+            entry->value = old_entry->value;
+        }
+    }
+
+    vector_free(&old_entries);
+
+    FINALLY
+    if (new_entries) {
+        vector_free(&new_entries);
+    }
+
+    RETURN;
+}
@@ -1,145 +1,238 @@
 #include "common.h"
 
-#include <datatypes/pictureclass.h>
-#include <proto/datatypes.h>
-
+#define BODY_MIN_SIZE 1024
+#define BODY_HINT_MAX_FACTOR 8
 #define INDENT 3
-
-static Status generate_element(char** page_html_p, Element* element, Page* page, uint indent);
-static Status generate_image_tags(char** page_html_p, char* dir_path, Element* element, uint indent);
-static Status make_breadcrumb_string(char** title_str_p, Page* page);
+#define NODE_TAG_SIZE 16
+#define LT_ESCAPE "&lt;"
+#define AMP_ESCAPE "&amp;"
+#define TEMPLATE_SLOTS (TEMPLATE_PARTS - 1)
+#define TEXT_BUFFER_SIZE 256
+
+static Status append_archive_link(char** body_html_p, uint page_number, const char* label);
+static Status append_body_end(char** body_html_p);
+static Status append_body_start(char** body_html_p, Site* site, Page* page);
+static Status append_post_rows(char** body_html_p, Page* pages, size_t* post_indices, size_t post_count, const char* url_prefix);
+static Status append_tag_links(char** body_html_p, Page* page);
+static Status close_element(char** page_html_p, Page* page, const Node* node, uint indent);
+static Status generate_image_tags(char** page_html_p, Site* site, char* dir_path, const char* url, uint indent);
+static bool has_caption(Page* page, const Node* node);
+static Status make_breadcrumb_string(Page* pages, Page* page);
 static Status make_formatted_date(char** date_str_p, Page* page);
-static Status make_title_string(char** title_str_p, Page* page);
-
-static struct {
-    char* page_template;
-} g;
-
-Status html_init(const char* base_path) {
+static Status make_page_html(char** page_html_p, Site* site, const char* body_html, const char* title_str);
+static Status make_title_string(Page* pages, Page* page);
+static Status open_element(char** page_html_p, Site* site, Page* page, size_t node_index, uint indent);
+static Status split_template(Site* site, const char* template_html);
+
+// The site's page.html is split once around $BODY and $TITLE, so filling it in is a few appends and
+// never searches the body for a marker.
+Status html_init(Site* site) {
     TRY
     char* html_path = NULL;
+    char* template_html = NULL;
 
-    CHECK(string_path_join(&html_path, base_path, "page.html"));
-    CHECK(file_read(&g.page_template, html_path));
+    CHECK(string_path_join(&html_path, site->base_path, "page.html"));
+    CHECK(file_read(&template_html, html_path));
+    CHECK(split_template(site, template_html));
 
     FINALLY
+    string_free(&template_html);
     string_free(&html_path);
 
     RETURN;
 }
 
-void html_fini(void) {
-    string_free(&g.page_template);
+void html_fini(Site* site) {
+    for (uint part = 0; part < TEMPLATE_PARTS; ++ part) {
+        string_free(&site->template_parts[part]);
+    }
 }
 
-Status html_generate(char** page_html_p, Page* page) {
+// Appends length characters of Markdown source. Escaped text loses its backslashes and has < and &
+// replaced, while verbatim text takes the default case throughout. Spans are not terminated, so each
+// is copied into a buffer sized for every character being escaped, on the stack unless it is long.
+Status html_append_text(char** html_p, const char* text, size_t length, bool escape) {
     TRY
-    char* date_str = NULL;
-    char* title_str = NULL;
-    char* breadcrumb_str = NULL;
-    char* body_html = NULL;
+    char buffer[TEXT_BUFFER_SIZE];
+    char* long_buffer = NULL;
+    size_t max_length = length * MAX(strlen(LT_ESCAPE), strlen(AMP_ESCAPE));
+    const char* text_end = text + length;
 
-    CHECK(make_formatted_date(&date_str, page));
+    if (length == 0) {
+        THROW(StatusOK);
+    }
 
-    CHECK(string_clone(&title_str, "Amiga Geek"));
-    CHECK(make_title_string(&title_str, page));
+    if (max_length >= TEXT_BUFFER_SIZE) {
+        CHECK(string_new(&long_buffer, max_length));
+    }
 
-    CHECK(string_new(&body_html, 0));
+    char* out_start = long_buffer ? long_buffer : buffer;
+    char* next_out = out_start;
+
+    for (const char* next_char = text; next_char < text_end; ++ next_char) {
+        switch (escape ? *next_char : 0) {
+        case '\\':
+            break;
+        case '<':
+            memcpy(next_out, LT_ESCAPE, strlen(LT_ESCAPE));
+            next_out += strlen(LT_ESCAPE);
+            break;
+        case '&':
+            memcpy(next_out, AMP_ESCAPE, strlen(AMP_ESCAPE));
+            next_out += strlen(AMP_ESCAPE);
+            break;
+        default:
+            *(next_out ++) = *next_char;
+            break;
+        }
+    }
 
-    if (page->parent) {
-        CHECK(string_clone(&breadcrumb_str, "<a href=\"/\">Home</a>"));
-        CHECK(make_breadcrumb_string(&breadcrumb_str, page->parent));
+    *next_out = '\0';
+    CHECK(string_append(html_p, out_start));
 
-        CHECK(string_append_indent(&body_html, "<tr>\n", INDENT));
-        CHECK(string_append_indent(&body_html, "<td>", INDENT + 1));
-        CHECK(string_append(&body_html, breadcrumb_str));
-        CHECK(string_append(&body_html, "</td>\n"));
-        CHECK(string_append_indent(&body_html, "</tr>\n", INDENT));
-        CHECK(string_append_indent(&body_html, "<tr>\n", INDENT));
-        CHECK(string_append_indent(&body_html, "<td class=\"hrule\" height=\"1\" bgcolor=\"#383860\"></td>\n", INDENT + 1));
-        CHECK(string_append_indent(&body_html, "</tr>\n", INDENT));
-    }
+    FINALLY
+    string_free(&long_buffer);
 
-    CHECK(string_append_indent(&body_html, "<tr>\n", INDENT));
-    CHECK(string_append_indent(&body_html, "<td class=\"content\">\n", INDENT + 1));
-    CHECK(string_append_indent(&body_html, "<p class=\"heading\"><font size=\"+2\"><b>", INDENT + 2));
-    CHECK(string_append(&body_html, page->title));
-    CHECK(string_append(&body_html, "</b></font></p>\n"));
-    CHECK(string_append_indent(&body_html, "<p>Last updated: ", INDENT + 2));
-    CHECK(string_append(&body_html, date_str));
-    CHECK(string_append(&body_html, "</p>\n"));
+    RETURN;
+}
 
-    CHECK(string_append_indent(&body_html, "<table width=\"100%\" cellspacing=\"0\" cellpadding=\"0\">\n", INDENT + 2));
-    CHECK(string_append_indent(&body_html, "<tr>\n", INDENT + 3));
-    CHECK(string_append_indent(&body_html, "<td class=\"vspace\" height=\"10\"></td>\n", INDENT + 4));
-    CHECK(string_append_indent(&body_html, "</tr>\n", INDENT + 3));
-    CHECK(string_append_indent(&body_html, "<tr>\n", INDENT + 3));
-    CHECK(string_append_indent(&body_html, "<td class=\"hrule\" height=\"1\" bgcolor=\"#383860\"></td>\n", INDENT + 4));
-    CHECK(string_append_indent(&body_html, "</tr>\n", INDENT + 3));
-    CHECK(string_append_indent(&body_html, "</table>\n", INDENT + 2));
+Status html_generate(char** page_html_p, Site* site, Page* page) {
+    TRY
+    char* body_html = NULL;
+
+    CHECK(html_generate_body(&body_html, site, page));
+    CHECK(html_generate_page(page_html_p, site, page, body_html));
+
+    FINALLY
+    string_free(&body_html);
 
-    vector_foreach(page->children, Element, child) {
-        CHECK(generate_element(&body_html, child, page, INDENT + 2));
+    RETURN;
+}
+
+// The body depends only on the page's content and its ancestors' titles, never on page.html. The
+// content's own HTML is the page->content_length characters at page->content_offset, which the feed
+// can reuse. The buffer is allocated up front from the size of the page's last body, or else one
+// guessed from its nodes, so that it rarely grows while being rendered. The last size comes from a
+// file in the cache, so one far beyond the guess is taken to be damaged and ignored.
+Status html_generate_body(char** body_html_p, Site* site, Page* page) {
+    TRY
+    char* body_html = NULL;
+    uint indent = INDENT + 2;
+    size_t body_size = BODY_MIN_SIZE;
+    size_t last_body_size = hash_map_find(&site->body_sizes, page->relative_url);
+
+    vector_foreach(page->nodes, Node, node) {
+        body_size += node->text_length + node->url_length + NODE_TAG_SIZE;
     }
 
-    CHECK(string_append_indent(&body_html, "</td>\n", INDENT + 1));
-    CHECK(string_append_indent(&body_html, "</tr>\n", INDENT));
+    if ((last_body_size != HASH_NONE) && (last_body_size <= body_size * BODY_HINT_MAX_FACTOR)) {
+        body_size = last_body_size;
+    }
 
-    CHECK(string_clone(page_html_p, g.page_template));
-    CHECK(string_replace_first(page_html_p, "$BODY", body_html));
-    CHECK(string_replace_first(page_html_p, "$TITLE", title_str));
+    CHECK(string_new(&body_html, body_size + body_size / 8));
+    CHECK(string_truncate(&body_html, 0));
+    CHECK(append_body_start(&body_html, site, page));
+    page->content_offset = string_length(body_html);
+    CHECK(html_generate_nodes(&body_html, site, page, &indent));
+    page->content_length = string_length(body_html) - page->content_offset;
+    CHECK(append_body_end(&body_html));
+    CHECK(hash_map_insert(&site->body_sizes, page->relative_url, string_length(body_html)));
+
+    SWAP(*body_html_p, body_html);
 
     FINALLY
     string_free(&body_html);
-    string_free(&breadcrumb_str);
-    string_free(&title_str);
-    string_free(&date_str);
 
     RETURN;
 }
 
-Status html_generate_root(char** root_html_p, Page* pages) {
+// Elements are rendered in one pass over the page's nodes, each indented by the elements open around it.
+// A page parsed in chunks is rendered a chunk at a time, with the indent carried in *indent_p.
+Status html_generate_nodes(char** html_p, Site* site, Page* page, uint* indent_p) {
     TRY
-    Page* project_pages = NULL;
-    Page* post_pages = NULL;
-    char* body_html = NULL;
+    uint indent = *indent_p;
+
+    for (size_t node_index = 0; node_index < vector_length(page->nodes); ++ node_index) {
+        const Node* node = &page->nodes[node_index];
+
+        switch (node->kind) {
+        case NK_Open:
+            CHECK(open_element(html_p, site, page, node_index, indent));
+            ++ indent;
+            break;
+        case NK_Text:
+            CHECK(html_append_text(html_p, &page->source[node->text_offset], node->text_length,
+                node->type != ET_Preformatted));
+            break;
+        case NK_Close:
+            -- indent;
+            CHECK(close_element(html_p, page, node, indent));
+            break;
+        }
+    }
+
+    *indent_p = indent;
+
+    FINALLY RETURN;
+}
+
+Status html_generate_page(char** page_html_p, Site* site, Page* page, const char* body_html) {
+    TRY
+    CHECK(make_title_string(site->pages, page));
+    CHECK(make_page_html(page_html_p, site, body_html, page->full_title));
+
+    FINALLY RETURN;
+}
 
-    CHECK(vector_new(&project_pages, sizeof(Page), 0));
-    CHECK(vector_new(&post_pages, sizeof(Page), 0));
+// A page built in chunks starts with everything before its content, leaving the indent for
+// html_generate_nodes in *indent_p, and html_generate_page_end finishes it.
+Status html_generate_page_start(char** html_p, Site* site, Page* page, uint* indent_p) {
+    TRY
+    CHECK(make_title_string(site->pages, page));
+    CHECK(string_clone(html_p, site->template_parts[0]));
+
+    if (! site->template_body_first) {
+        CHECK(string_append(html_p, page->full_title));
+        CHECK(string_append(html_p, site->template_parts[1]));
+    }
 
-    vector_foreach(pages, Page, page) {
-        if (page->add_to_index) {
-            if (page->description) {
-                size_t insert_at = 0;
+    CHECK(append_body_start(html_p, site, page));
+    *indent_p = INDENT + 2;
 
-                for (; insert_at < vector_length(project_pages); ++ insert_at) {
-                    if (strcmp(page->title, project_pages[insert_at].title) < 0) {
-                        break;
-                    }
-                }
+    FINALLY RETURN;
+}
 
-                CHECK(vector_insert(&project_pages, insert_at, 1, page));
-            } else {
-                size_t insert_at = 0;
+Status html_generate_page_end(char** html_p, Site* site, Page* page) {
+    TRY
+    CHECK(append_body_end(html_p));
 
-                for (; insert_at < vector_length(post_pages); ++ insert_at) {
-                    if (strcmp(page->date, post_pages[insert_at].date) > 0) {
-                        break;
-                    }
-                }
+    if (site->template_body_first) {
+        CHECK(string_append(html_p, site->template_parts[1]));
 
-                CHECK(vector_insert(&post_pages, insert_at, 1, page));
-            }
+        if (site->template_has_title) {
+            CHECK(string_append(html_p, page->full_title));
         }
     }
 
+    CHECK(string_append(html_p, site->template_parts[2]));
+
+    FINALLY RETURN;
+}
+
+Status html_generate_root(char** root_html_p, Site* site, PageViews* views, size_t post_count, uint archive_page_count) {
+    TRY
+    Page* pages = site->pages;
+    char* body_html = NULL;
+
     CHECK(string_new(&body_html, 0));
     CHECK(string_append_indent(&body_html, "<tr>\n", INDENT));
     CHECK(string_append_indent(&body_html, "<td class=\"content\">\n", INDENT + 1));
     CHECK(string_append_indent(&body_html, "<p class=\"heading\"><font size=\"+2\"><b>Projects</b></font></p>\n", INDENT + 2));
     CHECK(string_append_indent(&body_html, "<table class=\"table\" cellspacing=\"0\" cellpadding=\"0\">\n", INDENT + 2));
 
-    vector_foreach(project_pages, Page, page) {
+    vector_foreach(views->projects, size_t, page_index_p) {
+        Page* page = &pages[*page_index_p];
+
         CHECK(string_append_indent(&body_html, "<tr>\n", INDENT + 3));
         CHECK(string_append_indent(&body_html, "<td class=\"vspace\" height=\"10\"></td></tr>\n", INDENT + 4));
         CHECK(string_append_indent(&body_html, "</tr>\n", INDENT + 3));
@@ -170,41 +263,285 @@ Status html_generate_root(char** root_html_p, Page* pages) {
     CHECK(string_append_indent(&body_html, "<p class=\"heading\"><font size=\"+2\"><b>Recent posts</b></font></p>\n", INDENT + 2));
     CHECK(string_append_indent(&body_html, "<table class=\"table\" cellspacing=\"0\" cellpadding=\"0\">\n", INDENT + 2));
 
-    vector_foreach(post_pages, Page, page) {
-        CHECK(string_append_indent(&body_html, "<tr>\n", INDENT + 3));
-        CHECK(string_append_indent(&body_html, "<td class=\"vspace\" height=\"10\"></td></tr>\n", INDENT + 4));
-        CHECK(string_append_indent(&body_html, "</tr>\n", INDENT + 3));
-        CHECK(string_append_indent(&body_html, "<tr>\n", INDENT + 3));
-        CHECK(string_append_indent(&body_html, "<td class=\"hspace\" width=\"10\"></td>\n", INDENT + 4));
-        CHECK(string_append_indent(&body_html, "<td>", INDENT + 4));
-        CHECK(string_append(&body_html, page->date));
-        CHECK(string_append(&body_html, "</td>\n"));
-        CHECK(string_append_indent(&body_html, "<td class=\"hspace\" width=\"10\"></td>\n", INDENT + 4));
-        CHECK(string_append_indent(&body_html, "<td><a href=\"", INDENT + 4));
-        CHECK(string_append(&body_html, page->relative_url));
-        CHECK(string_append(&body_html, "\">"));
-        CHECK(string_append(&body_html, page->title));
-        CHECK(string_append(&body_html, "</a></td>\n"));
-        CHECK(string_append_indent(&body_html, "<td class=\"hspace\" width=\"10\"></td>\n", INDENT + 4));
-        CHECK(string_append_indent(&body_html, "</tr>\n", INDENT + 3));
+    CHECK(append_post_rows(&body_html, pages, views->posts, post_count, ""));
+    CHECK(string_append_indent(&body_html, "</table>\n", INDENT + 2));
+
+    if (archive_page_count > 0) {
+        CHECK(string_append_indent(&body_html, "<p>", INDENT + 2));
+        CHECK(append_archive_link(&body_html, archive_page_count, "Older posts"));
+        CHECK(string_append(&body_html, "</p>\n"));
+    }
+
+    CHECK(string_append_indent(&body_html, "</td>\n", INDENT + 1));
+    CHECK(string_append_indent(&body_html, "</tr>\n", INDENT));
+
+    CHECK(make_page_html(root_html_p, site, body_html, "Home | Amiga Geek"));
+
+    FINALLY
+    string_free(&body_html);
+
+    RETURN;
+}
+
+Status html_generate_archive(char** archive_html_p, Site* site, size_t* post_indices, size_t post_count,
+    uint page_number, uint page_count)
+{
+    TRY
+    char* body_html = NULL;
+    char* title_str = NULL;
+
+    CHECK(string_new(&body_html, 0));
+    CHECK(string_append_indent(&body_html, "<tr>\n", INDENT));
+    CHECK(string_append_indent(&body_html, "<td class=\"content\">\n", INDENT + 1));
+    CHECK(string_append_indent(&body_html, "<p class=\"heading\"><font size=\"+2\"><b>Older posts</b></font></p>\n", INDENT + 2));
+    CHECK(string_append_indent(&body_html, "<table class=\"table\" cellspacing=\"0\" cellpadding=\"0\">\n", INDENT + 2));
+    CHECK(append_post_rows(&body_html, site->pages, post_indices, post_count, "/"));
+    CHECK(string_append_indent(&body_html, "</table>\n", INDENT + 2));
+    CHECK(string_append_indent(&body_html, "<p>", INDENT + 2));
+
+    if (page_number < page_count) {
+        CHECK(append_archive_link(&body_html, page_number + 1, "Newer posts"));
+    } else {
+        CHECK(string_append(&body_html, "<a href=\"/\">Newer posts</a>"));
     }
 
+    if (page_number > 1) {
+        CHECK(string_append(&body_html, " | "));
+        CHECK(append_archive_link(&body_html, page_number - 1, "Older posts"));
+    }
+
+    CHECK(string_append(&body_html, "</p>\n"));
+    CHECK(string_append_indent(&body_html, "</td>\n", INDENT + 1));
+    CHECK(string_append_indent(&body_html, "</tr>\n", INDENT));
+
+    CHECK(string_printf(&title_str, "Older posts, page %u | Amiga Geek", page_number));
+    CHECK(make_page_html(archive_html_p, site, body_html, title_str));
+
+    FINALLY
+    string_free(&title_str);
+    string_free(&body_html);
+
+    RETURN;
+}
+
+// Lists every page with the tag, newest first.
+Status html_generate_tag(char** tag_html_p, Site* site, Tag* tag) {
+    TRY
+    char* body_html = NULL;
+    char* title_str = NULL;
+
+    CHECK(string_new(&body_html, 0));
+    CHECK(string_append_indent(&body_html, "<tr>\n", INDENT));
+    CHECK(string_append_indent(&body_html, "<td class=\"content\">\n", INDENT + 1));
+    CHECK(string_append_indent(&body_html, "<p class=\"heading\"><font size=\"+2\"><b>Tagged ", INDENT + 2));
+    CHECK(string_append(&body_html, tag->name));
+    CHECK(string_append(&body_html, "</b></font></p>\n"));
+    CHECK(string_append_indent(&body_html, "<table class=\"table\" cellspacing=\"0\" cellpadding=\"0\">\n", INDENT + 2));
+    CHECK(append_post_rows(&body_html, site->pages, tag->page_indices, vector_length(tag->page_indices), "/"));
     CHECK(string_append_indent(&body_html, "</table>\n", INDENT + 2));
     CHECK(string_append_indent(&body_html, "</td>\n", INDENT + 1));
     CHECK(string_append_indent(&body_html, "</tr>\n", INDENT));
 
-    CHECK(string_clone(root_html_p, g.page_template));
-    CHECK(string_replace_first(root_html_p, "$BODY", body_html));
-    CHECK(string_replace_first(root_html_p, "$TITLE", "Home | Amiga Geek"));
+    CHECK(string_printf(&title_str, "Tagged %s | Amiga Geek", tag->name));
+    CHECK(make_page_html(tag_html_p, site, body_html, title_str));
 
     FINALLY
+    string_free(&title_str);
     string_free(&body_html);
-    vector_free(&post_pages);
-    vector_free(&project_pages);
 
     RETURN;
 }
 
+static Status append_body_start(char** body_html_p, Site* site, Page* page) {
+    TRY
+    Page* pages = site->pages;
+    char* date_str = NULL;
+
+    CHECK(make_formatted_date(&date_str, page));
+
+    if (page->parent_index != PAGE_INDEX_NONE) {
+        Page* parent = &pages[page->parent_index];
+
+        CHECK(make_breadcrumb_string(pages, parent));
+
+        CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT));
+        CHECK(string_append_indent(body_html_p, "<td>", INDENT + 1));
+        CHECK(string_append(body_html_p, parent->breadcrumb));
+        CHECK(string_append(body_html_p, "</td>\n"));
+        CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT));
+        CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT));
+        CHECK(string_append_indent(body_html_p, "<td class=\"hrule\" height=\"1\" bgcolor=\"#383860\"></td>\n", INDENT + 1));
+        CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT));
+    }
+
+    CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT));
+    CHECK(string_append_indent(body_html_p, "<td class=\"content\">\n", INDENT + 1));
+    CHECK(string_append_indent(body_html_p, "<p class=\"heading\"><font size=\"+2\"><b>", INDENT + 2));
+    CHECK(string_append(body_html_p, page->title));
+    CHECK(string_append(body_html_p, "</b></font></p>\n"));
+    CHECK(string_append_indent(body_html_p, "<p>Last updated: ", INDENT + 2));
+    CHECK(string_append(body_html_p, date_str));
+    CHECK(string_append(body_html_p, "</p>\n"));
+
+    if (page->tags && (vector_length(page->tags) > 0)) {
+        CHECK(append_tag_links(body_html_p, page));
+    }
+
+    CHECK(string_append_indent(body_html_p, "<table width=\"100%\" cellspacing=\"0\" cellpadding=\"0\">\n", INDENT + 2));
+    CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT + 3));
+    CHECK(string_append_indent(body_html_p, "<td class=\"vspace\" height=\"10\"></td>\n", INDENT + 4));
+    CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT + 3));
+    CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT + 3));
+    CHECK(string_append_indent(body_html_p, "<td class=\"hrule\" height=\"1\" bgcolor=\"#383860\"></td>\n", INDENT + 4));
+    CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT + 3));
+    CHECK(string_append_indent(body_html_p, "</table>\n", INDENT + 2));
+
+    FINALLY
+    string_free(&date_str);
+
+    RETURN;
+}
+
+static Status append_body_end(char** body_html_p) {
+    TRY
+    CHECK(string_append_indent(body_html_p, "</td>\n", INDENT + 1));
+    CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT));
+
+    FINALLY RETURN;
+}
+
+static Status append_post_rows(char** body_html_p, Page* pages, size_t* post_indices, size_t post_count, const char* url_prefix) {
+    TRY
+    for (size_t post_index = 0; post_index < post_count; ++ post_index) {
+        Page* page = &pages[post_indices[post_index]];
+
+        CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT + 3));
+        CHECK(string_append_indent(body_html_p, "<td class=\"vspace\" height=\"10\"></td></tr>\n", INDENT + 4));
+        CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT + 3));
+        CHECK(string_append_indent(body_html_p, "<tr>\n", INDENT + 3));
+        CHECK(string_append_indent(body_html_p, "<td class=\"hspace\" width=\"10\"></td>\n", INDENT + 4));
+        CHECK(string_append_indent(body_html_p, "<td>", INDENT + 4));
+        CHECK(string_append(body_html_p, page->date));
+        CHECK(string_append(body_html_p, "</td>\n"));
+        CHECK(string_append_indent(body_html_p, "<td class=\"hspace\" width=\"10\"></td>\n", INDENT + 4));
+        CHECK(string_append_indent(body_html_p, "<td><a href=\"", INDENT + 4));
+        CHECK(string_append(body_html_p, url_prefix));
+        CHECK(string_append(body_html_p, page->relative_url));
+        CHECK(string_append(body_html_p, "\">"));
+        CHECK(string_append(body_html_p, page->title));
+        CHECK(string_append(body_html_p, "</a></td>\n"));
+        CHECK(string_append_indent(body_html_p, "<td class=\"hspace\" width=\"10\"></td>\n", INDENT + 4));
+        CHECK(string_append_indent(body_html_p, "</tr>\n", INDENT + 3));
+    }
+
+    FINALLY RETURN;
+}
+
+static Status append_tag_links(char** body_html_p, Page* page) {
+    TRY
+    char* slug = NULL;
+
+    CHECK(string_append_indent(body_html_p, "<p>Tags: ", INDENT + 2));
+
+    for (size_t tag_index = 0; tag_index < vector_length(page->tags); ++ tag_index) {
+        CHECK(tags_make_slug(&slug, page->tags[tag_index]));
+
+        if (tag_index > 0) {
+            CHECK(string_append(body_html_p, ", "));
+        }
+
+        CHECK(string_append(body_html_p, "<a href=\"/tags/"));
+        CHECK(string_append(body_html_p, slug));
+        CHECK(string_append(body_html_p, "/\">"));
+        CHECK(string_append(body_html_p, page->tags[tag_index]));
+        CHECK(string_append(body_html_p, "</a>"));
+
+        string_free(&slug);
+    }
+
+    CHECK(string_append(body_html_p, "</p>\n"));
+
+    FINALLY
+    string_free(&slug);
+
+    RETURN;
+}
+
+static Status append_archive_link(char** body_html_p, uint page_number, const char* label) {
+    TRY
+    char* link_html = NULL;
+
+    CHECK(string_printf(&link_html, "<a href=\"/archive/page-%u/\">%s</a>", page_number, label));
+    CHECK(string_append(body_html_p, link_html));
+
+    FINALLY
+    string_free(&link_html);
+
+    RETURN;
+}
+
+static Status make_page_html(char** page_html_p, Site* site, const char* body_html, const char* title_str) {
+    TRY
+    if (! site->template_has_title) {
+        title_str = "";
+    }
+
+    const char* values[TEMPLATE_SLOTS] = {
+        site->template_body_first ? body_html : title_str,
+        site->template_body_first ? title_str : body_html,
+    };
+
+    size_t html_size = strlen(body_html) + strlen(title_str);
+
+    for (uint part = 0; part < TEMPLATE_PARTS; ++ part) {
+        html_size += string_length(site->template_parts[part]);
+    }
+
+    // The page is assembled in a buffer of its final size.
+    CHECK(string_new(page_html_p, html_size));
+    CHECK(string_truncate(page_html_p, 0));
+    CHECK(string_append(page_html_p, site->template_parts[0]));
+
+    for (uint slot = 0; slot < TEMPLATE_SLOTS; ++ slot) {
+        CHECK(string_append(page_html_p, values[slot]));
+        CHECK(string_append(page_html_p, site->template_parts[slot + 1]));
+    }
+
+    FINALLY RETURN;
+}
+
+static Status split_template(Site* site, const char* template_html) {
+    TRY
+    const char* body_marker = strstr(template_html, "$BODY");
+    const char* title_marker = strstr(template_html, "$TITLE");
+    const char* title_name = "$TITLE";
+
+    ASSERT(body_marker, "page.html must contain $BODY");
+
+    // A template without a title has an empty title slot straight after the body.
+    if (! title_marker) {
+        title_marker = body_marker + strlen("$BODY");
+        title_name = "";
+    }
+
+    bool body_first = (body_marker < title_marker);
+    const char* markers[TEMPLATE_SLOTS] = {body_first ? body_marker : title_marker, body_first ? title_marker : body_marker};
+    const char* marker_names[TEMPLATE_SLOTS] = {body_first ? "$BODY" : title_name, body_first ? title_name : "$BODY"};
+    const char* part_start = template_html;
+
+    site->template_body_first = body_first;
+    site->template_has_title = (title_name[0] != '\0');
+
+    for (uint slot = 0; slot < TEMPLATE_SLOTS; ++ slot) {
+        CHECK(string_clone_substr(&site->template_parts[slot], part_start, markers[slot] - part_start));
+        part_start = markers[slot] + strlen(marker_names[slot]);
+    }
+
+    CHECK(string_clone(&site->template_parts[TEMPLATE_SLOTS], part_start));
+
+    FINALLY RETURN;
+}
+
 static Status make_formatted_date(char** date_str_p, Page* page) {
     TRY
     const char* day_suffix = NULL;
@@ -237,55 +574,73 @@ static Status make_formatted_date(char** date_str_p, Page* page) {
     FINALLY RETURN;
 }
 
-static Status make_title_string(char** title_str_p, Page* page) {
+// Each page keeps its full title and breadcrumb trail, so that descendants only add their own part.
+static Status make_title_string(Page* pages, Page* page) {
     TRY
-    if (page->parent) {
-        CHECK(make_title_string(title_str_p, page->parent));
-    }
+    if (! page->full_title) {
+        const char* parent_title = "Amiga Geek";
 
-    CHECK(string_prepend(title_str_p, " | "));
-    CHECK(string_prepend(title_str_p, page->title));
+        if (page->parent_index != PAGE_INDEX_NONE) {
+            Page* parent = &pages[page->parent_index];
+
+            CHECK(make_title_string(pages, parent));
+            parent_title = parent->full_title;
+        }
+
+        CHECK(string_printf(&page->full_title, "%s | %s", page->title, parent_title));
+    }
 
     FINALLY RETURN;
 }
 
-static Status make_breadcrumb_string(char** title_str_p, Page* page) {
+static Status make_breadcrumb_string(Page* pages, Page* page) {
     TRY
-    if (page) {
-        if (page->parent) {
-            CHECK(make_breadcrumb_string(title_str_p, page->parent));
+    if (! page->breadcrumb) {
+        if (page->parent_index != PAGE_INDEX_NONE) {
+            Page* parent = &pages[page->parent_index];
+
+            CHECK(make_breadcrumb_string(pages, parent));
+            CHECK(string_clone(&page->breadcrumb, parent->breadcrumb));
+        } else {
+            CHECK(string_clone(&page->breadcrumb, "<a href=\"/\">Home</a>"));
         }
 
-        CHECK(string_append(title_str_p, " &raquo; <a href=\"/"));
-        CHECK(string_append(title_str_p, page->relative_url));
-        CHECK(string_append(title_str_p, "\">"));
-        CHECK(string_append(title_str_p, page->title));
-        CHECK(string_append(title_str_p, "</a>"));
+        CHECK(string_append(&page->breadcrumb, " &raquo; <a href=\"/"));
+        CHECK(string_append(&page->breadcrumb, page->relative_url));
+        CHECK(string_append(&page->breadcrumb, "\">"));
+        CHECK(string_append(&page->breadcrumb, page->title));
+        CHECK(string_append(&page->breadcrumb, "</a>"));
     }
 
     FINALLY RETURN;
 }
 
-static Status generate_element(char** page_html_p, Element* element, Page* page, uint indent) {
+static Status open_element(char** page_html_p, Site* site, Page* page, size_t node_index, uint indent) {
     TRY
     char* anchor_name = NULL;
+    char* url = NULL;
+    const Node* node = &page->nodes[node_index];
 
-    switch (element->type) {
+    switch (node->type) {
     case ET_Bold:
         CHECK(string_append(page_html_p, "<b>"));
         break;
-    case ET_Header:
-        ASSERT(vector_length(element->children) == 1 && element->children[0].type == ET_Text);
+    case ET_Header: {
+        const Node* text_node = &page->nodes[node_index + 1];
+
+        ASSERT((node_index + 2 < vector_length(page->nodes)) && (text_node->kind == NK_Text) &&
+            (page->nodes[node_index + 2].kind == NK_Close), "Headers must contain only plain text");
 
         CHECK(string_append_indent(page_html_p, "<a name=\"", indent));
-        CHECK(string_clone(&anchor_name, element->children[0].text));
+        CHECK(string_new(&anchor_name, 0));
+        CHECK(html_append_text(&anchor_name, &page->source[text_node->text_offset], text_node->text_length, true));
         string_tolower(anchor_name);
         CHECK(string_replace_all(&anchor_name, " ", "_"));
         CHECK(string_append(page_html_p, anchor_name));
-        string_free(&anchor_name);
         CHECK(string_append(page_html_p, "\"></a>\n"));
         CHECK(string_append_indent(page_html_p, "<p class=\"heading\"><font size=\"+2\"><b>", indent));
         break;
+    }
     case ET_HRule:
         CHECK(string_append_indent(page_html_p, "<table width=\"100%\" cellspacing=\"0\" cellpadding=\"0\">\n", indent));
         CHECK(string_append_indent(page_html_p, "<tr>\n", indent + 1));
@@ -296,9 +651,11 @@ static Status generate_element(char** page_html_p, Element* element, Page* page,
         CHECK(string_append_indent(page_html_p, "</table>\n", indent));
         break;
     case ET_Image: {
-        CHECK(generate_image_tags(page_html_p, page->dir_path, element, indent));
+        CHECK(string_new(&url, 0));
+        CHECK(html_append_text(&url, &page->source[node->url_offset], node->url_length, true));
+        CHECK(generate_image_tags(page_html_p, site, page->dir_path, url, indent));
 
-        if (string_length(element->text) > 0) {
+        if (has_caption(page, node)) {
             CHECK(string_append_indent(page_html_p, "<table cellspacing=\"0\" cellpadding=\"0\">\n", indent));
             CHECK(string_append_indent(page_html_p, "<tr>\n", indent + 1));
             CHECK(string_append_indent(page_html_p, "<td class=\"vspace\" height=\"10\"></td>\n", indent + 2));
@@ -312,7 +669,7 @@ static Status generate_element(char** page_html_p, Element* element, Page* page,
     }
     case ET_Link:
         CHECK(string_append(page_html_p, "<a href=\""));
-        CHECK(string_append(page_html_p, element->url));
+        CHECK(html_append_text(page_html_p, &page->source[node->url_offset], node->url_length, true));
         CHECK(string_append(page_html_p, "\">"));
         break;
     case ET_List:
@@ -339,15 +696,16 @@ static Status generate_element(char** page_html_p, Element* element, Page* page,
         break;
     }
 
-    if (element->text) {
-        CHECK(string_append(page_html_p, element->text));
-    }
+    FINALLY
+    string_free(&url);
+    string_free(&anchor_name);
 
-    vector_foreach(element->children, Element, child) {
-        CHECK(generate_element(page_html_p, child, page, indent + 1));
-    }
+    RETURN;
+}
 
-    switch (element->type) {
+static Status close_element(char** page_html_p, Page* page, const Node* node, uint indent) {
+    TRY
+    switch (node->type) {
     case ET_Bold:
         CHECK(string_append(page_html_p, "</b>"));
         break;
@@ -355,7 +713,7 @@ static Status generate_element(char** page_html_p, Element* element, Page* page,
         CHECK(string_append(page_html_p, "</b></font></p>\n"));
         break;
     case ET_Image:
-        if (string_length(element->text) > 0) {
+        if (has_caption(page, node)) {
             CHECK(string_append(page_html_p, "</b>\n"));
             CHECK(string_append_indent(page_html_p, "</td>\n", indent + 2));
             CHECK(string_append_indent(page_html_p, "<td class=\"hspace2\" width=\"20\"></td>\n", indent + 2));
@@ -385,33 +743,42 @@ static Status generate_element(char** page_html_p, Element* element, Page* page,
         break;
     }
 
-    FINALLY
-    string_free(&anchor_name);
+    FINALLY RETURN;
+}
 
-    RETURN;
+// Escaping drops backslashes, so a caption made only of them is no caption at all.
+static bool has_caption(Page* page, const Node* node) {
+    for (uint offset = 0; offset < node->text_length; ++ offset) {
+        if (page->source[node->text_offset + offset] != '\\') {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-static Status generate_image_tags(char** page_html_p, char* dir_path, Element* element, uint indent) {
+static Status generate_image_tags(char** page_html_p, Site* site, char* dir_path, const char* url, uint indent) {
     TRY
     char* half_file_name = NULL;
     char* image_path = NULL;
     char* text_html = NULL;
-    Object* image_dt = NULL;
-    struct BitMapHeader* image_bmh = NULL;
+    ImageSize image_size = {0};
+
+    stats_begin(SS_Images);
+    stats_count(SC_Images, 1);
 
-    CHECK(string_clone(&half_file_name, element->url));
-    CHECK(string_replace_first(&half_file_name, ".", "_half."));
+    CHECK(make_half_file_name(&half_file_name, url));
 
     CHECK(string_path_join(&image_path, dir_path, half_file_name));
-    ASSERT(image_dt = NewDTObject(image_path, DTA_SourceType, DTST_FILE, DTA_GroupID, GID_PICTURE, TAG_DONE));
-    ASSERT(GetDTAttrs(image_dt, PDTA_BitMapHeader, &image_bmh, TAG_DONE));
+
+    CHECK(images_get_size(&image_size, site->image_cache, image_path));
 
     CHECK(string_append_indent(page_html_p, "<center>\n", indent));
     CHECK(string_append_indent(page_html_p, "<div class=\"image\" style=\"content: url(", indent + 1));
-    CHECK(string_append(page_html_p, element->url));
+    CHECK(string_append(page_html_p, url));
     CHECK(string_append(page_html_p, "); "));
 
-    CHECK(string_printf(&text_html, "width: %upx; height: %upx\">\n", image_bmh->bmh_Width * 2, image_bmh->bmh_Height * 2));
+    CHECK(string_printf(&text_html, "width: %upx; height: %upx\">\n", image_size.width * 2, image_size.height * 2));
     CHECK(string_append(page_html_p, text_html));
     string_free(&text_html);
 
@@ -419,7 +786,7 @@ static Status generate_image_tags(char** page_html_p, char* dir_path, Element* e
     CHECK(string_append(page_html_p, half_file_name));
     CHECK(string_append(page_html_p, "\" "));
 
-    CHECK(string_printf(&text_html, "width=\"%d\" height=\"%d\"", image_bmh->bmh_Width, image_bmh->bmh_Height));
+    CHECK(string_printf(&text_html, "width=\"%u\" height=\"%u\"", image_size.width, image_size.height));
     CHECK(string_append(page_html_p, text_html));
     CHECK(string_append(page_html_p, ">\n"));
 
@@ -427,10 +794,10 @@ static Status generate_image_tags(char** page_html_p, char* dir_path, Element* e
     CHECK(string_append_indent(page_html_p, "</center>\n", indent));
 
     FINALLY
-    DisposeDTObject(image_dt);
     string_free(&text_html);
     string_free(&image_path);
     string_free(&half_file_name);
+    stats_end();
 
     RETURN;
 }
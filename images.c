@@ -0,0 +1,87 @@
+#include "common.h"
+
+#include <datatypes/pictureclass.h>
+#include <proto/datatypes.h>
+#include <sys/stat.h>
+
+static Status probe_size(ImageSize* size_p, const char* image_path);
+
+// Opening a picture through datatypes reads and decodes the whole file just to learn its size, so
+// sizes already found are kept for every site sharing the cache. They are keyed by the file's full
+// path from its lock, so an image that sites reach from different base paths is probed once. An entry
+// is used only while the file's size and date are those it was probed with, so a long-running server
+// sees replaced images.
+Status images_init(ImageCache* cache) {
+    TRY
+    CHECK(hash_map_init(&cache->paths));
+    CHECK(vector_new(&cache->sizes, sizeof(ImageSize), 0));
+
+    FINALLY RETURN;
+}
+
+void images_fini(ImageCache* cache) {
+    if (cache->sizes) {
+        vector_free(&cache->sizes);
+    }
+
+    hash_map_fini(&cache->paths);
+}
+
+// Probes the image every time when cache is NULL.
+Status images_get_size(ImageSize* size_p, ImageCache* cache, const char* image_path) {
+    TRY
+    char* real_path = NULL;
+    struct stat image_stat;
+    size_t size_index = HASH_NONE;
+
+    // A missing image is left for probe_size to report.
+    if ((! cache) || (stat(image_path, &image_stat) != 0)) {
+        CHECK(probe_size(size_p, image_path));
+        THROW(StatusOK);
+    }
+
+    CHECK(file_real_path(&real_path, image_path));
+    size_index = hash_map_find(&cache->paths, real_path);
+
+    if ((size_index != HASH_NONE) && (cache->sizes[size_index].file_size == (long)image_stat.st_size) &&
+        (cache->sizes[size_index].file_time == (unsigned long)image_stat.st_mtime))
+    {
+        *size_p = cache->sizes[size_index];
+        THROW(StatusOK);
+    }
+
+    CHECK(probe_size(size_p, image_path));
+    size_p->file_size = image_stat.st_size;
+    size_p->file_time = image_stat.st_mtime;
+
+    if (size_index == HASH_NONE) {
+        CHECK(vector_append(&cache->sizes, 1, size_p));
+        CHECK(hash_map_insert(&cache->paths, real_path, vector_length(cache->sizes) - 1));
+    } else {
+        cache->sizes[size_index] = *size_p;
+    }
+
+    FINALLY
+    string_free(&real_path);
+
+    RETURN;
+}
+
+static Status probe_size(ImageSize* size_p, const char* image_path) {
+    TRY
+    Object* image_dt = NULL;
+    struct BitMapHeader* image_bmh = NULL;
+
+    trace_begin("image probe", image_path);
+    ASSERT(image_dt = NewDTObject((APTR)image_path, DTA_SourceType, DTST_FILE, DTA_GroupID, GID_PICTURE, TAG_DONE));
+    ASSERT(GetDTAttrs(image_dt, PDTA_BitMapHeader, &image_bmh, TAG_DONE));
+
+    size_p->width = image_bmh->bmh_Width;
+    size_p->height = image_bmh->bmh_Height;
+
+    FINALLY
+    trace_end();
+    DisposeDTObject(image_dt);
+
+    RETURN;
+}
@@ -0,0 +1,34 @@
+#include "common.h"
+
+// The command line's --stats and --trace keep their figures and files in process-wide state, so the
+// library leaves alloc.c, eclock.c, memory.c, stats.c and trace.c out and links these calls, which do
+// nothing, in their place. Allocations are also only counted when the linker wraps malloc, which a
+// program linking libagp.a is not asked to do.
+size_t memory_peak(void) {
+    return 0;
+}
+
+void memory_sample(void) {
+}
+
+void stats_begin(StatsStage stage) {
+}
+
+void stats_count(StatsCounter counter, size_t amount) {
+}
+
+void stats_end(void) {
+}
+
+void stats_page_begin(const char* path) {
+}
+
+Status stats_page_end(const char* path) {
+    return StatusOK;
+}
+
+void trace_begin(const char* name, const char* path) {
+}
+
+void trace_end(void) {
+}
@@ -0,0 +1,307 @@
+#include "common.h"
+
+#include <dirent.h>
+
+// A link or image in a page's Markdown. path is the file or page it refers to, relative to BASEDIR,
+// and page paths end in a slash as relative URLs do. key is path in lower case for the lookups, as
+// AmigaDOS matches names without regard to case.
+typedef struct {
+    size_t page_index;
+    uint line;
+    char* url;
+    char* path;
+    char* key;
+    bool is_image;
+} Reference;
+
+static Status add_reference(Reference** references_p, Page* page, size_t page_index, uint line, const char* url,
+    bool is_image);
+static Status collect_references(Reference** references_p, Site* site, size_t page_index);
+static bool is_generated(const char* path);
+static bool is_local(const char* url);
+static bool is_page_path(const char* path);
+static Status list_files(HashMap* files, Site* site, Reference* references);
+static void normalize_path(char* path);
+static Status reference_exists(bool* exists_p, HashMap* page_urls, HashMap* files, Reference* reference);
+
+// Reports every local link that leads nowhere and every image missing from BASEDIR, giving the file
+// and line it appears on. Links to other sites are not followed. Pages are known from the scan, and
+// each directory holding a referenced file is read once to fill a set of the files present, so
+// checking a reference is a lookup rather than a file system call.
+Status links_check(Site* site) {
+    TRY
+    Reference* references = NULL;
+    HashMap page_urls = {0};
+    HashMap files = {0};
+    char* page_url = NULL;
+    uint broken_count = 0;
+
+    CHECK(page_scan_all(site));
+    CHECK(hash_map_init(&page_urls));
+    CHECK(hash_map_init(&files));
+    CHECK(vector_new(&references, sizeof(Reference), 0));
+
+    for (size_t page_index = 0; page_index < vector_length(site->pages); ++ page_index) {
+        CHECK(string_clone(&page_url, site->pages[page_index].relative_url));
+        string_tolower(page_url);
+        CHECK(hash_map_insert(&page_urls, page_url, page_index));
+        string_free(&page_url);
+
+        CHECK(collect_references(&references, site, page_index));
+    }
+
+    vector_foreach(site->tags, Tag, tag) {
+        CHECK(string_printf(&page_url, "tags/%s/", tag->slug));
+        CHECK(hash_map_insert(&page_urls, page_url, 0));
+        string_free(&page_url);
+    }
+
+    CHECK(list_files(&files, site, references));
+
+    vector_foreach(references, Reference, reference) {
+        bool exists = false;
+
+        CHECK(reference_exists(&exists, &page_urls, &files, reference));
+
+        if (! (exists || ((! reference->is_image) && is_generated(reference->key)))) {
+            printf("%s:%u: %s %s\n", site->pages[reference->page_index].markdown_path, reference->line,
+                reference->is_image ? "missing image" : "broken link", reference->is_image ? reference->path : reference->url);
+            ++ broken_count;
+        }
+    }
+
+    printf("Checked %u links and images in %u pages, %u broken\n", (uint)vector_length(references),
+        (uint)vector_length(site->pages), broken_count);
+
+    FINALLY
+    if (references) {
+        vector_foreach(references, Reference, reference) {
+            string_free(&reference->url);
+            string_free(&reference->path);
+            string_free(&reference->key);
+        }
+
+        vector_free(&references);
+    }
+
+    string_free(&page_url);
+    hash_map_fini(&files);
+    hash_map_fini(&page_urls);
+
+    RETURN;
+}
+
+// Images need both the full size file and the half size one shown in the page.
+static Status collect_references(Reference** references_p, Site* site, size_t page_index) {
+    TRY
+    Page page = {0};
+    char* url = NULL;
+    char* half_url = NULL;
+    const char* content = NULL;
+    size_t line_offset = 0;
+    uint line = 1;
+
+    CHECK(file_read(&page.source, site->pages[page_index].markdown_path));
+    CHECK(markdown_parse_frontmatter(page.source, &page, &content));
+    CHECK(cache_read_nodes(site, &page));
+
+    if (! page.nodes) {
+        CHECK(vector_new(&page.nodes, sizeof(Node), 0));
+        CHECK(markdown_parse_content(content, &page));
+        CHECK(cache_write_nodes(site, &page));
+    }
+
+    vector_foreach(page.nodes, Node, node) {
+        if ((node->kind != NK_Open) || ((node->type != ET_Link) && (node->type != ET_Image))) {
+            continue;
+        }
+
+        // Nodes follow the source, so lines are counted once over the whole page.
+        for (; line_offset < node->url_offset; ++ line_offset) {
+            line += (page.source[line_offset] == '\n');
+        }
+
+        CHECK(string_clone_substr(&url, &page.source[node->url_offset], node->url_length));
+
+        if (node->type == ET_Image) {
+            CHECK(make_half_file_name(&half_url, url));
+            CHECK(add_reference(references_p, &site->pages[page_index], page_index, line, url, true));
+            CHECK(add_reference(references_p, &site->pages[page_index], page_index, line, half_url, true));
+            string_free(&half_url);
+        } else if (is_local(url)) {
+            CHECK(add_reference(references_p, &site->pages[page_index], page_index, line, url, false));
+        }
+
+        string_free(&url);
+    }
+
+    FINALLY
+    string_free(&half_url);
+    string_free(&url);
+    page_free(&page);
+
+    RETURN;
+}
+
+// URLs are resolved as a browser would from the page's own URL. Any query or fragment is dropped.
+static Status add_reference(Reference** references_p, Page* page, size_t page_index, uint line, const char* url,
+    bool is_image)
+{
+    TRY
+    Reference reference = {page_index, line, NULL, NULL, NULL, is_image};
+
+    CHECK(string_clone(&reference.url, url));
+    CHECK(string_clone(&reference.path, (url[0] == '/') ? "" : page->relative_url));
+    CHECK(string_append(&reference.path, url));
+    normalize_path(reference.path);
+    CHECK(string_clone(&reference.key, reference.path));
+    string_tolower(reference.key);
+
+    CHECK(vector_append(references_p, 1, &reference));
+    reference.url = NULL;
+    reference.path = NULL;
+    reference.key = NULL;
+
+    FINALLY
+    string_free(&reference.key);
+    string_free(&reference.path);
+    string_free(&reference.url);
+
+    RETURN;
+}
+
+// Fills files with the lower case path of every file in each directory that a reference points into.
+// A directory that cannot be read adds nothing, so every reference into it is reported.
+static Status list_files(HashMap* files, Site* site, Reference* references) {
+    TRY
+    HashMap dirs = {0};
+    DIR* dir = NULL;
+    char* relative_dir_path = NULL;
+    char* dir_path = NULL;
+    char* file_path = NULL;
+
+    CHECK(hash_map_init(&dirs));
+
+    vector_foreach(references, Reference, reference) {
+        if (is_page_path(reference->path)) {
+            continue;
+        }
+
+        const char* name = strrchr(reference->path, '/');
+        size_t dir_length = name ? (name - reference->path + 1) : 0;
+
+        CHECK(string_clone_substr(&file_path, reference->key, dir_length));
+
+        if (hash_map_find(&dirs, file_path) == HASH_NONE) {
+            CHECK(hash_map_insert(&dirs, file_path, 0));
+            CHECK(string_clone_substr(&relative_dir_path, reference->path, dir_length));
+            CHECK(string_path_join(&dir_path, site->base_path, relative_dir_path));
+            string_free(&relative_dir_path);
+
+            if ((dir = opendir(dir_path))) {
+                for (struct dirent* dir_ent; (dir_ent = readdir(dir));) {
+                    CHECK(string_truncate(&file_path, dir_length));
+                    CHECK(string_append(&file_path, dir_ent->d_name));
+                    string_tolower(file_path);
+                    CHECK(hash_map_insert(files, file_path, 0));
+                }
+
+                closedir(dir);
+                dir = NULL;
+            }
+
+            string_free(&dir_path);
+        }
+
+        string_free(&file_path);
+    }
+
+    FINALLY
+    if (dir) {
+        closedir(dir);
+    }
+
+    string_free(&file_path);
+    string_free(&dir_path);
+    string_free(&relative_dir_path);
+    hash_map_fini(&dirs);
+
+    RETURN;
+}
+
+// A link to a page's directory without the final slash, or to its index.html, still finds the page.
+static Status reference_exists(bool* exists_p, HashMap* page_urls, HashMap* files, Reference* reference) {
+    TRY
+    char* page_url = NULL;
+
+    if (reference->is_image || (! is_page_path(reference->path))) {
+        *exists_p = (hash_map_find(files, reference->key) != HASH_NONE);
+
+        if (*exists_p || reference->is_image) {
+            THROW(StatusOK);
+        }
+
+        CHECK(string_clone(&page_url, reference->key));
+
+        if (string_endswith(page_url, "index.html")) {
+            CHECK(string_truncate(&page_url, string_length(page_url) - strlen("index.html")));
+        } else {
+            CHECK(string_append(&page_url, "/"));
+        }
+
+        *exists_p = (hash_map_find(page_urls, page_url) != HASH_NONE);
+    } else {
+        *exists_p = (hash_map_find(page_urls, reference->key) != HASH_NONE);
+    }
+
+    FINALLY
+    string_free(&page_url);
+
+    RETURN;
+}
+
+// The build writes these as well as the pages. How many archive pages there are depends on
+// --index-posts and the search index is only written with --search-index, so links into them are
+// taken on trust.
+static bool is_generated(const char* path) {
+    return (strcmp(path, "index.xml") == 0) || string_startswith(path, "archive/") || string_startswith(path, "search/");
+}
+
+// Links with a scheme or a protocol-relative "//host" lead off the site, and links within the page
+// have nothing to check.
+static bool is_local(const char* url) {
+    size_t scheme_length = strcspn(url, ":/?#");
+
+    return (url[0] != '\0') && (url[0] != '#') && (url[0] != '?') && (url[scheme_length] != ':') &&
+        (! string_startswith(url, "//"));
+}
+
+static bool is_page_path(const char* path) {
+    return (path[0] == '\0') || string_endswith(path, "/");
+}
+
+// Drops any query or fragment, empty and "." segments and each ".." along with the segment before it,
+// leaving a path relative to BASEDIR. Nothing is above BASEDIR, so ".." there is dropped alone.
+static void normalize_path(char* path) {
+    char* out = path;
+
+    path[strcspn(path, "?#")] = '\0';
+
+    for (char* next = (path[0] == '/') ? &path[1] : path; *next;) {
+        size_t length = strcspn(next, "/");
+        bool has_slash = (next[length] == '/');
+
+        if ((length == 2) && (next[0] == '.') && (next[1] == '.')) {
+            if (out > path) {
+                for (-- out; (out > path) && (out[-1] != '/'); -- out);
+            }
+        } else if ((length > 0) && (! ((length == 1) && (next[0] == '.')))) {
+            memmove(out, next, length + has_slash);
+            out += length + has_slash;
+        }
+
+        next += length + has_slash;
+    }
+
+    *out = '\0';
+}
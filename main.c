@@ -2,21 +2,35 @@
 
 #include <getopt.h>
 #include <proto/exec.h>
+#include <proto/openurl.h>
 
 typedef enum {
     PM_All,
+    PM_CheckLinks,
     PM_Live,
+    PM_Render,
+    PM_Serve,
 } ProgramMode;
 
 typedef struct  {
-    const char* base_path;
+    const char* archive_path;
+    const char** base_paths;
+    const char* cache_path;
+    BuildOptions build_options;
     ProgramMode program_mode;
+    const char* render_path;
+    uint serve_port;
+    bool stats;
+    const char* stats_path;
+    const char* trace_path;
 } Arguments;
 
 static Status args_parse(Arguments* args, int argc, char *argv[]);
+static Status run_site(Arguments* args, const char* base_path, ImageCache* image_cache, Output* output);
 
-struct Library* OpenURLBase;
-
+// Several sites given with --basedir are built or checked in turn by this one process, so libraries
+// are opened once, images shared between sites are probed once and the stats cover them all. The
+// sites may share a cache directory, as page bodies are found by their content.
 int main(int argc, char *argv[]) {
     TRY
 #ifdef FORTIFY
@@ -24,23 +38,38 @@ int main(int argc, char *argv[]) {
 #endif
 
     Arguments args = {0};
+    ImageCache image_cache = {0};
+    Output output = {0};
+
+    memory_init();
 
     ASSERT(OpenURLBase = OpenLibrary("openurl.library", 0));
     CHECK(args_parse(&args, argc, argv));
-    CHECK(html_init(args.base_path));
-    CHECK(page_init());
+    CHECK(output_init(&output, args.archive_path, args.base_paths[0]));
+    CHECK(stats_init(args.stats));
+    CHECK(trace_init(args.trace_path));
+    CHECK(images_init(&image_cache));
 
-    if (args.program_mode == PM_All) {
-        CHECK(page_build_all(args.base_path));
-    } else {
-        CHECK(page_build_live(args.base_path));
+    vector_foreach(args.base_paths, const char*, base_path_p) {
+        CHECK(run_site(&args, *base_path_p, &image_cache, &output));
     }
 
+    CHECK(output_close(&output));
+    CHECK(trace_close());
+    CHECK(stats_report(args.stats_path));
+
     FINALLY
-    page_fini();
-    html_fini();
+    images_fini(&image_cache);
+    trace_fini();
+    stats_fini();
+    eclock_fini();
+    output_fini(&output);
     CloseLibrary(OpenURLBase);
 
+    if (args.base_paths) {
+        vector_free(&args.base_paths);
+    }
+
 #ifdef FORTIFY
     Fortify_LeaveScope();
 #endif
@@ -48,46 +77,160 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
+static Status run_site(Arguments* args, const char* base_path, ImageCache* image_cache, Output* output) {
+    TRY
+    Site site = {0};
+    BuildResult result = {0};
+
+    site.image_cache = image_cache;
+    site.output = output;
+
+    if (vector_length(args->base_paths) > 1) {
+        printf("Site %s\n", base_path);
+    }
+
+    CHECK(site_init(&site, base_path, args->cache_path));
+
+    if (args->program_mode == PM_All) {
+        CHECK(page_build_all(&result, &site, &args->build_options));
+
+        if (args->build_options.search_index) {
+            printf("Search index %u KB, %u bytes per page\n", (uint)(result.search_index_size / 1024),
+                (uint)(result.search_index_size / MAX(1, result.search_page_count)));
+        }
+
+        printf("Built %u pages, peak memory use %u KB\n", result.page_count, (uint)(memory_peak() / 1024));
+    } else if (args->program_mode == PM_CheckLinks) {
+        CHECK(links_check(&site));
+    } else if (args->program_mode == PM_Live) {
+        CHECK(page_build_live(&site));
+    } else if (args->program_mode == PM_Render) {
+        CHECK(page_render_stdin(&site, args->render_path));
+    } else {
+        CHECK(serve_run(&site, args->serve_port));
+    }
+
+    FINALLY
+    site_fini(&site);
+
+    RETURN;
+}
+
 static Status args_parse(Arguments* args, int argc, char *argv[]) {
     TRY
     bool opt_all = false;
+    bool opt_check_links = false;
     bool opt_live = false;
+    bool opt_render = false;
+    bool opt_serve = false;
+
+    CHECK(vector_new(&args->base_paths, sizeof(const char*), 0));
 
     struct option long_opts[] = {
-        {"all",     no_argument,       NULL, 'a'},
-        {"basedir", required_argument, NULL, 'b'},
-        {"help",    no_argument,       NULL, 'h'},
-        {"live",    no_argument,       NULL, 'l'},
-        {NULL,      0,                 NULL, 0  }
+        {"all",            no_argument,       NULL, 'a'},
+        {"basedir",        required_argument, NULL, 'b'},
+        {"cache",          required_argument, NULL, 'c'},
+        {"check-links",    no_argument,       NULL, 'k'},
+        {"feed-content",   required_argument, NULL, 'F'},
+        {"feed-items",     required_argument, NULL, 'f'},
+        {"help",           no_argument,       NULL, 'h'},
+        {"index-posts",    required_argument, NULL, 'i'},
+        {"live",           no_argument,       NULL, 'l'},
+        {"output-archive", required_argument, NULL, 'o'},
+        {"render",         required_argument, NULL, 'r'},
+        {"search-index",   no_argument,       NULL, 'x'},
+        {"serve",          required_argument, NULL, 'S'},
+        {"stats",          optional_argument, NULL, 's'},
+        {"trace",          required_argument, NULL, 't'},
+        {NULL,             0,                 NULL, 0  }
     };
 
-    for (int short_opt; (short_opt = getopt_long(argc, argv, "ab:hl", long_opts, NULL)) != -1;) {
+    for (int short_opt; (short_opt = getopt_long(argc, argv, "ab:c:F:f:hi:klo:r:S:s::t:x", long_opts, NULL)) != -1;) {
         switch (short_opt) {
         case 'a':
             opt_all = true;
             break;
         case 'b':
-            args->base_path = optarg;
+            CHECK(vector_append(&args->base_paths, 1, &optarg));
+            break;
+        case 'c':
+            args->cache_path = optarg;
+            break;
+        case 'F':
+            CHECK(parse_count(&args->build_options.feed_content_size, optarg, "--feed-content"));
+            args->build_options.feed_content_size *= 1024;
+            break;
+        case 'f':
+            CHECK(parse_count(&args->build_options.feed_item_count, optarg, "--feed-items"));
+            break;
+        case 'i':
+            CHECK(parse_count(&args->build_options.index_post_count, optarg, "--index-posts"));
+            break;
+        case 'k':
+            opt_check_links = true;
             break;
         case 'l':
             opt_live = true;
             break;
+        case 'o':
+            args->archive_path = optarg;
+            break;
+        case 'r':
+            opt_render = true;
+            args->render_path = optarg;
+            break;
+        case 'S':
+            opt_serve = true;
+            CHECK(parse_count(&args->serve_port, optarg, "--serve"));
+            break;
+        case 's':
+            args->stats = true;
+            args->stats_path = optarg;
+            break;
+        case 't':
+            args->trace_path = optarg;
+            break;
+        case 'x':
+            args->build_options.search_index = true;
+            break;
         case 'h':
             fprintf(stderr, "Usage: AGP -b BASEDIR [OPTION]...\n\n");
-            fprintf(stderr, "  -a, --all      Find and build all index.md files under BASEDIR\n");
-            fprintf(stderr, "  -b, --basedir  Top-level website directory\n");
-            fprintf(stderr, "  -h, --help     Show this help message\n");
-            fprintf(stderr, "  -l, --live     Find index.md opened in TextEdit, build and reload HTML\n");
+            fprintf(stderr, "  -a, --all             Find and build all index.md files under BASEDIR\n");
+            fprintf(stderr, "  -b, --basedir         Top-level website directory, repeated to build several\n");
+            fprintf(stderr, "  -c, --cache DIR       Keep rendered page bodies in DIR to skip unchanged pages\n");
+            fprintf(stderr, "  -F, --feed-content KB Put each item's page in index.xml unless over KB kilobytes\n");
+            fprintf(stderr, "  -f, --feed-items      Limit index.xml to the N most recent items\n");
+            fprintf(stderr, "  -h, --help            Show this help message\n");
+            fprintf(stderr, "  -i, --index-posts     List N posts on index.html and the rest on archive pages\n");
+            fprintf(stderr, "  -k, --check-links     Report broken links and missing images in all pages\n");
+            fprintf(stderr, "  -l, --live            Find index.md opened in TextEdit, build and reload HTML\n");
+            fprintf(stderr, "  -o, --output-archive  Write the built site and its images to a tar file\n");
+            fprintf(stderr, "  -r, --render PATH     Render Markdown from stdin as the page at PATH to stdout\n");
+            fprintf(stderr, "  -S, --serve PORT      Serve BASEDIR over HTTP, rendering pages when requested\n");
+            fprintf(stderr, "  -s, --stats[=FILE]    Print build timings and counts, also as JSON to FILE\n");
+            fprintf(stderr, "  -t, --trace FILE      Write a Chrome trace of the build to FILE\n");
+            fprintf(stderr, "  -x, --search-index    Write a search index of all pages to BASEDIR/search\n");
         case ':':
         case '?':
             THROW(StatusQuit);
         }
     }
 
-    ASSERT(args->base_path, "Option --basedir is required");
-    ASSERT(opt_all != opt_live, "Option --all or --live is required");
-
-    args->program_mode = opt_all ? PM_All : PM_Live;
+    ASSERT(vector_length(args->base_paths) > 0, "Option --basedir is required");
+    ASSERT(opt_all + opt_check_links + opt_live + opt_render + opt_serve == 1,
+        "Option --all, --check-links, --live, --render or --serve is required");
+    ASSERT((vector_length(args->base_paths) == 1) || opt_all || opt_check_links,
+        "Options --live, --render and --serve take one --basedir");
+    ASSERT((! opt_render) || (! args->stats), "Option --stats cannot be used with --render");
+    ASSERT((! opt_render) || (! args->cache_path), "Option --cache cannot be used with --render");
+    ASSERT((vector_length(args->base_paths) == 1) || (! args->archive_path),
+        "Option --output-archive takes one --basedir");
+    ASSERT(opt_all || (! args->archive_path), "Option --output-archive requires --all");
+    ASSERT(opt_all || (! args->build_options.search_index), "Option --search-index requires --all");
+    ASSERT(opt_all || (args->build_options.feed_content_size == 0), "Option --feed-content requires --all");
+
+    args->program_mode = opt_all ? PM_All : (opt_check_links ? PM_CheckLinks : (opt_live ? PM_Live :
+        (opt_render ? PM_Render : PM_Serve)));
 
     FINALLY RETURN;
 }
@@ -9,33 +9,67 @@
     (! escape_next_char) &&                         \
     (next_char += strlen(STR)))
 
-#define LT_ESCAPE "&lt;"
-#define AMP_ESCAPE "&amp;"
-
-static Status append_element(Element** new_element_p, Element** elements_p, ElementType type,
-    const char* text_start, const char* text_end, const char* url_start, const char* url_end);
-static Status escape_string(char** string_p);
-static Status parse_blocks(Page* page, const char* next_char, const char* end_char);
+static Status append_element(Page* page, ElementType type, const char* text_start, const char* text_end,
+    const char* url_start, const char* url_end);
+static Status append_node(Page* page, NodeKind kind, ElementType type, const char* text_start, const char* text_end,
+    const char* url_start, const char* url_end);
+static Status close_block(Page* page, ElementType* open_block_p);
+static Status parse_blocks(Page* page, MarkdownState* state, const char** next_char_p, const char* end_char,
+    bool is_last);
 static Status parse_front_matter(Page* page, const char** next_char_p, const char* end_char);
-static Status parse_inlines(Element** elements_p, const char** next_char_p, const char* end_char);
+static Status parse_inlines(Page* page, const char** next_char_p, const char* end_char);
+static Status parse_tags(Page* page, const char* value_start, const char* value_end);
 
-Status markdown_parse_frontmatter(const char* text, Page* page) {
+// content_p, when given, is left at the first character after the front matter.
+Status markdown_parse_frontmatter(const char* text, Page* page, const char** content_p) {
     TRY
     const char* next_char = text;
     const char* end_char = text + strlen(text);
 
     CHECK(parse_front_matter(page, &next_char, end_char));
 
+    if (content_p) {
+        *content_p = next_char;
+    }
+
     FINALLY RETURN;
 }
 
-Status markdown_parse_all(const char* text, Page* page) {
+// content must point into page->source, as nodes refer to their text by offset from its start.
+Status markdown_parse_content(const char* content, Page* page) {
     TRY
-    const char* next_char = text;
-    const char* end_char = text + strlen(text);
+    MarkdownState state = {0};
+
+    CHECK(parse_blocks(page, &state, &content, content + strlen(content), true));
+
+    FINALLY RETURN;
+}
+
+// Parses a page one chunk at a time, each chunk but the last ending in a newline that is not escaped.
+// Blocks left open are recorded in state and continued by the next chunk. A preformatted block is
+// added a chunk of text at a time, and the newline ending a chunk inside one is left unparsed, as it
+// is dropped if the closing fence follows. *parsed_length_p is the length of content that was parsed,
+// and the rest must start the next chunk.
+Status markdown_parse_chunk(const char* content, Page* page, MarkdownState* state, bool is_last,
+    size_t* parsed_length_p)
+{
+    TRY
+    const char* next_char = content;
+
+    CHECK(parse_blocks(page, state, &next_char, content + strlen(content), is_last));
+    *parsed_length_p = next_char - content;
+
+    FINALLY RETURN;
+}
+
+Status markdown_parse_all(Page* page) {
+    TRY
+    MarkdownState state = {0};
+    const char* next_char = page->source;
+    const char* end_char = next_char + strlen(next_char);
 
     CHECK(parse_front_matter(page, &next_char, end_char));
-    CHECK(parse_blocks(page, next_char, end_char));
+    CHECK(parse_blocks(page, &state, &next_char, end_char, true));
 
     FINALLY RETURN;
 }
@@ -53,8 +87,13 @@ static Status parse_front_matter(Page* page, const char** next_char_p, const cha
         bool is_title = CONSUME_STRING("Title: ");
         bool is_date = CONSUME_STRING("Date: ");
         bool is_desc = CONSUME_STRING("Description: ");
+        bool is_tags = CONSUME_STRING("Tags: ");
 
-        if (is_title || is_date || is_desc) {
+        if (is_tags) {
+            const char* value_start = next_char;
+            CONSUME_UNTIL('\n');
+            CHECK(parse_tags(page, value_start, next_char));
+        } else if (is_title || is_date || is_desc) {
             const char* value_start = next_char;
             CONSUME_UNTIL('\n');
             size_t value_len = next_char - value_start;
@@ -87,10 +126,52 @@ static Status parse_front_matter(Page* page, const char** next_char_p, const cha
     page->date_day = MAX(1, MIN(31, page->date_day));
     page->date_month = MAX(1, MIN(12, page->date_month));
 
+    // Packed so that comparing keys orders pages by date.
+    page->date_key = (page->date_year << 9) | (page->date_month << 5) | page->date_day;
+
     FINALLY RETURN;
 }
 
-static Status parse_blocks(Page* page, const char* next_char, const char* end_char) {
+// Tags are separated by commas, e.g. "Tags: Amiga, Hardware", with spaces around each ignored.
+static Status parse_tags(Page* page, const char* value_start, const char* value_end) {
+    TRY
+    char* tag = NULL;
+
+    if (! page->tags) {
+        CHECK(vector_new(&page->tags, sizeof(char*), 0));
+    }
+
+    while (value_start < value_end) {
+        const char* tag_end = memchr(value_start, ',', value_end - value_start);
+        const char* next_start = tag_end ? tag_end + 1 : value_end;
+
+        if (! tag_end) {
+            tag_end = value_end;
+        }
+
+        for (; (value_start < tag_end) && (*value_start == ' '); ++ value_start);
+        for (; (tag_end > value_start) && (tag_end[-1] == ' '); -- tag_end);
+
+        if (tag_end > value_start) {
+            CHECK(string_clone_substr(&tag, value_start, tag_end - value_start));
+            CHECK(vector_append(&page->tags, 1, &tag));
+            tag = NULL;
+        }
+
+        value_start = next_start;
+    }
+
+    FINALLY
+    string_free(&tag);
+
+    RETURN;
+}
+
+// Lists and paragraphs stay open across lines, so each is closed when a blank line, another block or
+// the end of the page follows it. Only the last chunk of a page closes what is still open at its end.
+static Status parse_blocks(Page* page, MarkdownState* state, const char** next_char_p, const char* end_char,
+    bool is_last)
+{
     TRY
     typedef enum {
         TT_None,
@@ -101,9 +182,10 @@ static Status parse_blocks(Page* page, const char* next_char, const char* end_ch
         TT_Preformatted,
     } TokenType;
 
-    TokenType open_token = TT_None;
-    Element* open_block = NULL;
-    const char* text_start = NULL;
+    TokenType open_token = state->open_token;
+    ElementType open_block = state->open_block;
+    const char* next_char = *next_char_p;
+    const char* text_start = next_char;
     const char* text_end = NULL;
     const char* url_start = NULL;
     bool escape_next_char = false;
@@ -112,6 +194,7 @@ static Status parse_blocks(Page* page, const char* next_char, const char* end_ch
         if (CONSUME_STRING("\n")) {
             if (open_token != TT_Preformatted) {
                 open_token = TT_None;
+                CHECK(close_block(page, &open_block));
             }
         } else {
             if (CONSUME_STRING("\\")) {
@@ -122,32 +205,41 @@ static Status parse_blocks(Page* page, const char* next_char, const char* end_ch
             switch (open_token) {
             case TT_None:
             case TT_List:
-                if (CONSUME_STRING("# ")) {
-                    open_token = TT_None;
-                    CHECK(append_element(&open_block, &page->children, ET_Header, NULL, NULL, NULL, NULL));
-                    CHECK(parse_inlines(&open_block->children, &next_char, end_char));
-                } else if (CONSUME_STRING("- ")) {
+                if (CONSUME_STRING("- ")) {
                     if (open_token != TT_List) {
                         open_token = TT_List;
-                        CHECK(append_element(&open_block, &page->children, ET_List, NULL, NULL, NULL, NULL));
+                        open_block = ET_List;
+                        CHECK(append_node(page, NK_Open, ET_List, NULL, NULL, NULL, NULL));
                     }
 
-                    Element* list_item;
-                    CHECK(append_element(&list_item, &open_block->children, ET_ListItem, NULL, NULL, NULL, NULL));
-                    CHECK(parse_inlines(&list_item->children, &next_char, end_char));
+                    CHECK(append_node(page, NK_Open, ET_ListItem, NULL, NULL, NULL, NULL));
+                    CHECK(parse_inlines(page, &next_char, end_char));
+                    CHECK(append_node(page, NK_Close, ET_ListItem, NULL, NULL, NULL, NULL));
+                    break;
+                }
+
+                CHECK(close_block(page, &open_block));
+
+                if (CONSUME_STRING("# ")) {
+                    open_token = TT_None;
+                    CHECK(append_node(page, NK_Open, ET_Header, NULL, NULL, NULL, NULL));
+                    CHECK(parse_inlines(page, &next_char, end_char));
+                    CHECK(append_node(page, NK_Close, ET_Header, NULL, NULL, NULL, NULL));
                 } else if (CONSUME_STRING("![")) {
                     open_token = TT_ImageText;
                     text_start = next_char;
                 } else if (CONSUME_STRING("***\n")) {
                     open_token = TT_None;
-                    CHECK(append_element(NULL, &page->children, ET_HRule, NULL, NULL, NULL, NULL));
+                    CHECK(append_element(page, ET_HRule, NULL, NULL, NULL, NULL));
                 } else if (CONSUME_STRING("```\n")) {
                     open_token = TT_Preformatted;
                     text_start = next_char;
+                    CHECK(append_node(page, NK_Open, ET_Preformatted, NULL, NULL, NULL, NULL));
                 } else {
                     open_token = TT_Paragraph;
-                    CHECK(append_element(&open_block, &page->children, ET_Paragraph, NULL, NULL, NULL, NULL));
-                    CHECK(parse_inlines(&open_block->children, &next_char, end_char));
+                    open_block = ET_Paragraph;
+                    CHECK(append_node(page, NK_Open, ET_Paragraph, NULL, NULL, NULL, NULL));
+                    CHECK(parse_inlines(page, &next_char, end_char));
                 }
                 break;
             case TT_ImageText:
@@ -165,21 +257,25 @@ static Status parse_blocks(Page* page, const char* next_char, const char* end_ch
 
                 if (CONSUME_STRING(")")) {
                     open_token = TT_None;
-                    CHECK(append_element(&open_block, &page->children, ET_Image, text_start, text_end, url_start, url_end));
+                    CHECK(append_element(page, ET_Image, text_start, text_end, url_start, url_end));
                 } else {
                     ++ next_char;
                 }
                 break;
             }
             case TT_Paragraph:
-                CHECK(parse_inlines(&open_block->children, &next_char, end_char));
+                CHECK(parse_inlines(page, &next_char, end_char));
                 break;
             case TT_Preformatted:
                 text_end = next_char;
 
                 if (CONSUME_STRING("```\n")) {
                     open_token = TT_None;
-                    CHECK(append_element(NULL, &page->children, ET_Preformatted, text_start, text_end - 1, NULL, NULL));
+
+                    // The newline before the closing fence is not part of the text.
+                    CHECK(append_node(page, NK_Text, ET_Preformatted, text_start, MAX(text_start, text_end - 1),
+                        NULL, NULL));
+                    CHECK(append_node(page, NK_Close, ET_Preformatted, NULL, NULL, NULL, NULL));
                 } else {
                     ++ next_char;
                 }
@@ -190,10 +286,36 @@ static Status parse_blocks(Page* page, const char* next_char, const char* end_ch
         escape_next_char = false;
     }
 
+    if (open_token == TT_Preformatted) {
+        // A fence never closed runs to the end of the page. Otherwise the text so far is added and the
+        // newline ending the chunk is left for the next.
+        const char* chunk_end = ((next_char > text_start) && (next_char[-1] == '\n')) ? next_char - 1 : next_char;
+
+        if (is_last) {
+            CHECK(append_node(page, NK_Text, ET_Preformatted, text_start, chunk_end, NULL, NULL));
+            CHECK(append_node(page, NK_Close, ET_Preformatted, NULL, NULL, NULL, NULL));
+            open_token = TT_None;
+        } else {
+            if (chunk_end > text_start) {
+                CHECK(append_node(page, NK_Text, ET_Preformatted, text_start, chunk_end, NULL, NULL));
+            }
+
+            next_char = chunk_end;
+        }
+    }
+
+    if (is_last) {
+        CHECK(close_block(page, &open_block));
+    }
+
+    state->open_token = open_token;
+    state->open_block = open_block;
+    *next_char_p = next_char;
+
     FINALLY RETURN;
 }
 
-static Status parse_inlines(Element** elements_p, const char** next_char_p, const char* end_char) {
+static Status parse_inlines(Page* page, const char** next_char_p, const char* end_char) {
     TRY
     typedef enum {
         TT_None,
@@ -225,7 +347,7 @@ static Status parse_inlines(Element** elements_p, const char** next_char_p, cons
             bool is_bold = CONSUME_STRING("**");
 
             if (open_token && (is_link || is_bold)) {
-                CHECK(append_element(NULL, elements_p, ET_Text, token_start, token_end, NULL, NULL));
+                CHECK(append_element(page, ET_Text, token_start, token_end, NULL, NULL));
                 token_start = token_end;
             }
 
@@ -243,7 +365,7 @@ static Status parse_inlines(Element** elements_p, const char** next_char_p, cons
         }
         case TT_Bold:
             if (CONSUME_STRING("**")) {
-                CHECK(append_element(NULL, elements_p, ET_Bold, text_start, token_end, NULL, NULL));
+                CHECK(append_element(page, ET_Bold, text_start, token_end, NULL, NULL));
                 open_token = TT_None;
                 token_start = next_char;
             } else {
@@ -261,7 +383,7 @@ static Status parse_inlines(Element** elements_p, const char** next_char_p, cons
             break;
         case TT_LinkURL:
             if (CONSUME_STRING(")")) {
-                CHECK(append_element(NULL, elements_p, ET_Link, text_start, text_end, url_start, token_end));
+                CHECK(append_element(page, ET_Link, text_start, text_end, url_start, token_end));
                 open_token = TT_None;
                 token_start = next_char;
             } else {
@@ -274,7 +396,7 @@ static Status parse_inlines(Element** elements_p, const char** next_char_p, cons
     }
 
     if (open_token) {
-        CHECK(append_element(NULL, elements_p, ET_Text, token_start, token_end, NULL, NULL));
+        CHECK(append_element(page, ET_Text, token_start, token_end, NULL, NULL));
     }
 
     *next_char_p = next_char;
@@ -282,63 +404,60 @@ static Status parse_inlines(Element** elements_p, const char** next_char_p, cons
     FINALLY RETURN;
 }
 
-static Status append_element(Element** new_element_p, Element** elements_p, ElementType type,
-    const char* text_start, const char* text_end, const char* url_start, const char* url_end)
+// Appends an element that has no child elements, with its text as a single text node.
+static Status append_element(Page* page, ElementType type, const char* text_start, const char* text_end,
+    const char* url_start, const char* url_end)
 {
     TRY
-    CHECK(vector_append(elements_p, 1, NULL));
-    Element* element = &(*elements_p)[vector_length(*elements_p) - 1];
+    if (type == ET_Text) {
+        CHECK(append_node(page, NK_Text, ET_Text, text_start, text_end, NULL, NULL));
+        stats_count(SC_Elements, 1);
+        THROW(StatusOK);
+    }
 
-    CHECK(vector_new(&element->children, sizeof(Element), 0));
-    element->type = type;
+    CHECK(append_node(page, NK_Open, type, text_start, text_end, url_start, url_end));
 
     if (text_start) {
-        CHECK(string_clone_substr(&element->text, text_start, text_end - text_start));
+        CHECK(append_node(page, NK_Text, ET_Text, text_start, text_end, NULL, NULL));
+    }
 
-        if (element->type != ET_Preformatted) {
-            CHECK(escape_string(&element->text));
-        }
+    CHECK(append_node(page, NK_Close, type, text_start, text_end, url_start, url_end));
+
+    FINALLY RETURN;
+}
+
+static Status append_node(Page* page, NodeKind kind, ElementType type, const char* text_start, const char* text_end,
+    const char* url_start, const char* url_end)
+{
+    TRY
+    CHECK(vector_append(&page->nodes, 1, NULL));
+    Node* node = &vector_last(page->nodes);
+
+    node->kind = kind;
+    node->type = type;
+
+    if (text_start) {
+        node->text_offset = text_start - page->source;
+        node->text_length = text_end - text_start;
     }
 
     if (url_start) {
-        CHECK(string_clone_substr(&element->url, url_start, url_end - url_start));
-        CHECK(escape_string(&element->url));
+        node->url_offset = url_start - page->source;
+        node->url_length = url_end - url_start;
     }
 
-    if (new_element_p) {
-        *new_element_p = element;
+    if (kind == NK_Open) {
+        stats_count(SC_Elements, 1);
     }
 
     FINALLY RETURN;
 }
 
-static Status escape_string(char** string_p) {
+static Status close_block(Page* page, ElementType* open_block_p) {
     TRY
-    char* string = *string_p;
-    size_t length = string_length(string);
-
-    for (size_t index = 0; index < length; ) {
-        switch (string[index]) {
-        case '\\':
-            CHECK(vector_remove(string_p, index, 1));
-            break;
-        case '<':
-            CHECK(vector_remove(string_p, index, 1));
-            CHECK(vector_insert(string_p, index, strlen(LT_ESCAPE), LT_ESCAPE));
-            index += strlen(LT_ESCAPE);
-            break;
-        case '&':
-            CHECK(vector_remove(string_p, index, 1));
-            CHECK(vector_insert(string_p, index, strlen(AMP_ESCAPE), AMP_ESCAPE));
-            index += strlen(AMP_ESCAPE);
-            break;
-        default:
-            ++ index;
-            continue;
-        }
-
-        string = *string_p;
-        length = string_length(string);
+    if (*open_block_p != ET_None) {
+        CHECK(append_node(page, NK_Close, *open_block_p, NULL, NULL, NULL, NULL));
+        *open_block_p = ET_None;
     }
 
     FINALLY RETURN;
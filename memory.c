@@ -0,0 +1,27 @@
+#include "common.h"
+
+#include <proto/exec.h>
+
+// Free memory is sampled at the points where a build holds the most data. It also sees allocations
+// made by other tasks, so the peak is an upper bound on what AGP itself needed.
+static struct {
+    ULONG start_avail;
+    ULONG min_avail;
+} g;
+
+void memory_init(void) {
+    g.start_avail = AvailMem(MEMF_ANY);
+    g.min_avail = g.start_avail;
+}
+
+void memory_sample(void) {
+    ULONG avail = AvailMem(MEMF_ANY);
+
+    if (avail < g.min_avail) {
+        g.min_avail = avail;
+    }
+}
+
+size_t memory_peak(void) {
+    return (g.start_avail > g.min_avail) ? (g.start_avail - g.min_avail) : 0;
+}
@@ -0,0 +1,340 @@
+#include "common.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_COPY_SIZE 4096
+#define TAR_NAME_SIZE 100
+#define TAR_PREFIX_SIZE 155
+
+typedef struct {
+    char name[TAR_NAME_SIZE];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type_flag;
+    char link_name[100];
+    char magic[6];
+    char version[2];
+    char user_name[32];
+    char group_name[32];
+    char dev_major[8];
+    char dev_minor[8];
+    char prefix[TAR_PREFIX_SIZE];
+    char padding[12];
+} TarHeader;
+
+static Status write_header(Output* output, const char* path, size_t size);
+static Status write_padding(Output* output, size_t size);
+
+// The caller owns each Output and points the sites it builds at it, so a program embedding AGP can
+// build several sites at once as long as each has its own.
+Status output_init(Output* output, const char* archive_path, const char* base_path) {
+    TRY
+    output->archive_path = archive_path;
+    output->base_path = base_path;
+
+    if (archive_path) {
+        ASSERT(output->archive = fopen(archive_path, "wb"), "Error accessing file %s", archive_path);
+        CHECK(hash_map_init(&output->added_files));
+    }
+
+    FINALLY RETURN;
+}
+
+void output_fini(Output* output) {
+    hash_map_fini(&output->added_files);
+
+    if (output->archive) {
+        fclose(output->archive);
+        output->archive = NULL;
+    }
+}
+
+// Files written by an earlier build can only be left in place when the site is written to BASEDIR.
+bool output_is_archive(Output* output) {
+    return output->archive != NULL;
+}
+
+Status output_close(Output* output) {
+    TRY
+    char end_blocks[TAR_BLOCK_SIZE * 2] = {0};
+
+    if (output->archive) {
+        ASSERT(fwrite(end_blocks, 1, sizeof(end_blocks), output->archive) == sizeof(end_blocks),
+            "Error accessing file %s", output->archive_path);
+        ASSERT(fclose(output->archive) == 0, "Error accessing file %s", output->archive_path);
+        output->archive = NULL;
+    }
+
+    FINALLY RETURN;
+}
+
+Status output_write(Output* output, const char* contents, const char* path) {
+    TRY
+    size_t size = strlen(contents);
+
+    stats_begin(SS_Write);
+    stats_count(SC_BytesWritten, size);
+
+    if (! output->archive) {
+        CHECK(file_write(contents, path));
+        THROW(StatusOK);
+    }
+
+    CHECK(write_header(output, path, size));
+    ASSERT(fwrite(contents, 1, size, output->archive) == size, "Error accessing file %s", output->archive_path);
+    CHECK(write_padding(output, size));
+
+    FINALLY
+    stats_end();
+
+    RETURN;
+}
+
+// A file too large to build in memory is written in pieces, from output_begin to output_end. Its size
+// is only known at the end, so in an archive its header is written again then. Each file keeps its own
+// state, so sites writing to BASEDIR from several tasks do not meet here.
+Status output_begin(Output* output, OutputFile* output_file, const char* path) {
+    TRY
+    output_file->size = 0;
+    CHECK(string_clone(&output_file->path, path));
+
+    if (! output->archive) {
+        ASSERT(output_file->file = fopen(path, "wb"), "Error accessing file %s", path);
+        THROW(StatusOK);
+    }
+
+    ASSERT((output_file->header_offset = ftell(output->archive)) >= 0, "Error accessing file %s",
+        output->archive_path);
+    CHECK(write_header(output, path, 0));
+
+    FINALLY RETURN;
+}
+
+Status output_append(Output* output, OutputFile* output_file, const char* contents) {
+    TRY
+    size_t size = strlen(contents);
+    FILE* file = output->archive ? output->archive : output_file->file;
+
+    stats_begin(SS_Write);
+    stats_count(SC_BytesWritten, size);
+
+    ASSERT(fwrite(contents, 1, size, file) == size, "Error accessing file %s",
+        output->archive ? output->archive_path : output_file->path);
+    output_file->size += size;
+
+    FINALLY
+    stats_end();
+
+    RETURN;
+}
+
+Status output_end(Output* output, OutputFile* output_file) {
+    TRY
+    if (! output->archive) {
+        FILE* file = output_file->file;
+
+        output_file->file = NULL;
+        ASSERT(fclose(file) == 0, "Error accessing file %s", output_file->path);
+        THROW(StatusOK);
+    }
+
+    CHECK(write_padding(output, output_file->size));
+
+    long end_offset;
+    ASSERT((end_offset = ftell(output->archive)) >= 0, "Error accessing file %s", output->archive_path);
+    ASSERT(fseek(output->archive, output_file->header_offset, SEEK_SET) == 0, "Error accessing file %s",
+        output->archive_path);
+    CHECK(write_header(output, output_file->path, output_file->size));
+    ASSERT(fseek(output->archive, end_offset, SEEK_SET) == 0, "Error accessing file %s", output->archive_path);
+
+    FINALLY
+    string_free(&output_file->path);
+
+    RETURN;
+}
+
+// Releases a file left unfinished by a failed build. Does nothing after output_end.
+void output_free(OutputFile* output_file) {
+    if (output_file->file) {
+        fclose(output_file->file);
+        output_file->file = NULL;
+    }
+
+    string_free(&output_file->path);
+}
+
+Status output_write_changed(Output* output, const char* contents, const char* path) {
+    TRY
+    char* old_contents = NULL;
+    struct stat path_stat;
+
+    if ((! output->archive) && (stat(path, &path_stat) == 0)) {
+        CHECK(file_read(&old_contents, path));
+
+        if (strcmp(old_contents, contents) == 0) {
+            THROW(StatusOK);
+        }
+    }
+
+    CHECK(output_write(output, contents, path));
+
+    FINALLY
+    string_free(&old_contents);
+
+    RETURN;
+}
+
+Status output_make_dir(Output* output, const char* path) {
+    TRY
+    struct stat path_stat;
+
+    // Archive entries carry their full path, so only a directory tree needs creating.
+    if ((! output->archive) && (stat(path, &path_stat) != 0)) {
+        ASSERT(mkdir(path, 0755) == 0, "Cannot create directory %s", path);
+    }
+
+    FINALLY RETURN;
+}
+
+// Removes a page an earlier build left in BASEDIR and which the site no longer has, along with its
+// directory unless something else was put there.
+Status output_remove_page(Output* output, const char* dir_path) {
+    TRY
+    char* html_path = NULL;
+    struct stat path_stat;
+
+    if (output->archive) {
+        THROW(StatusOK);
+    }
+
+    CHECK(string_path_join(&html_path, dir_path, "index.html"));
+
+    if (stat(html_path, &path_stat) == 0) {
+        ASSERT(remove(html_path) == 0, "Cannot delete file %s", html_path);
+    }
+
+    remove(dir_path);
+
+    FINALLY
+    string_free(&html_path);
+
+    RETURN;
+}
+
+Status output_add_file(Output* output, const char* path) {
+    TRY
+    FILE* file = NULL;
+    char* buffer = NULL;
+
+    // Files referenced from pages already live in BASEDIR unless we are building an archive. An image
+    // shown more than once is stored once.
+    if ((! output->archive) || (hash_map_find(&output->added_files, path) != HASH_NONE)) {
+        THROW(StatusOK);
+    }
+
+    CHECK(hash_map_insert(&output->added_files, path, 0));
+    ASSERT(file = fopen(path, "rb"), "Error accessing file %s", path);
+    stats_begin(SS_Write);
+
+    ASSERT(fseek(file, 0, SEEK_END) == 0, "Error accessing file %s", path);
+
+    long file_size;
+    ASSERT((file_size = ftell(file)) >= 0, "Error accessing file %s", path);
+    rewind(file);
+
+    CHECK(write_header(output, path, file_size));
+    CHECK(string_new(&buffer, TAR_COPY_SIZE));
+
+    for (size_t remaining = file_size; remaining > 0;) {
+        size_t chunk_size = MIN(remaining, TAR_COPY_SIZE);
+
+        ASSERT(fread(buffer, 1, chunk_size, file) == chunk_size, "Error accessing file %s", path);
+        ASSERT(fwrite(buffer, 1, chunk_size, output->archive) == chunk_size, "Error accessing file %s",
+            output->archive_path);
+        remaining -= chunk_size;
+    }
+
+    CHECK(write_padding(output, file_size));
+    stats_count(SC_BytesWritten, file_size);
+
+    FINALLY
+    string_free(&buffer);
+
+    if (file) {
+        fclose(file);
+        stats_end();
+    }
+
+    RETURN;
+}
+
+static Status write_header(Output* output, const char* path, size_t size) {
+    TRY
+    TarHeader header = {0};
+    size_t base_len = strlen(output->base_path);
+
+    ASSERT(strncmp(path, output->base_path, base_len) == 0, "%s is outside of BASEDIR", path);
+
+    const char* name = &path[base_len];
+
+    while (*name == '/') {
+        ++ name;
+    }
+
+    // Names too long for the header are split at a directory separator into prefix and name.
+    size_t name_len = strlen(name);
+    const char* split = name;
+
+    if (name_len > TAR_NAME_SIZE) {
+        split = strchr(&name[name_len - TAR_NAME_SIZE - 1], '/');
+        ASSERT(split && (split - name <= TAR_PREFIX_SIZE), "Path too long for archive: %s", name);
+
+        memcpy(header.prefix, name, split - name);
+        ++ split;
+    }
+
+    memcpy(header.name, split, strlen(split));
+
+    // Fixed ownership and timestamp keep the archive identical across builds of the same site.
+    sprintf(header.mode, "%07o", 0644);
+    sprintf(header.uid, "%07o", 0);
+    sprintf(header.gid, "%07o", 0);
+    sprintf(header.size, "%011lo", (unsigned long)size);
+    sprintf(header.mtime, "%011lo", 0UL);
+    header.type_flag = '0';
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    memset(header.checksum, ' ', sizeof(header.checksum));
+
+    unsigned long checksum = 0;
+
+    for (size_t i = 0; i < sizeof(header); ++ i) {
+        checksum += ((unsigned char*)&header)[i];
+    }
+
+    sprintf(header.checksum, "%06lo", checksum);
+    header.checksum[7] = ' ';
+
+    ASSERT(fwrite(&header, 1, sizeof(header), output->archive) == sizeof(header), "Error accessing file %s",
+        output->archive_path);
+
+    FINALLY RETURN;
+}
+
+static Status write_padding(Output* output, size_t size) {
+    TRY
+    char padding[TAR_BLOCK_SIZE] = {0};
+    size_t padding_size = (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+
+    ASSERT(fwrite(padding, 1, padding_size, output->archive) == padding_size, "Error accessing file %s",
+        output->archive_path);
+
+    FINALLY RETURN;
+}
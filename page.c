@@ -1,216 +1,992 @@
 #include "common.h"
 
-#include <dirent.h>
-#include <limits.h>
 #include <proto/dos.h>
 #include <proto/openurl.h>
+#include <proto/utility.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-static Status build_all_pages(const char* dir_path, const char* dir_url, const char* filter_path, Page* parent);
-static Status build_page(Page* page);
-static void free_elements(Element** elements);
+#define CHUNK_SIZE 16384
+#define CHUNK_MIN_PAGE_SIZE (256 * 1024)
+#define EXALL_BUFFER_SIZE 4096
+
+// A directory still to be walked, with the index of the page that pages below it hang from.
+typedef struct {
+    char* path;
+    char* url;
+    size_t parent_index;
+} WalkDir;
+
+// A subdirectory or index.md, as ExAll lists it.
+typedef struct {
+    char* name;
+    long size;
+    bool is_dir;
+} WalkEntry;
+
+static Status add_ancestors(Site* site, const char* relative_url);
+static Status build_archive_pages(Site* site, PageViews* views, size_t root_post_count, uint posts_per_page);
+static Status build_all_pages(Site* site, const char* base_path, const char* filter_path);
+static Status build_page(Site* site, Page* page, size_t markdown_size);
+static Status build_page_in_chunks(Site* site, Page* page, const char* html_path);
+static int entry_name_compare(const void* entry1_p, const void* entry2_p);
+static size_t find_chunk_end(const char* text, size_t length);
+static void free_entries(WalkEntry** entries_p);
+static void free_nodes(Page* page);
+static void free_strings(char*** strings_p);
 static Status get_live_url(char** live_url_p, const char* path, const char* base_path);
-static Status get_real_path(char** real_path_p, const char* path);
+static Status keep_feed_html(Site* site, Page* page, const char* body_html);
+static Status list_dir(WalkEntry** entries_p, struct ExAllControl* control, ULONG* buffer, const char* dir_path);
+static Status make_image_urls(Page* page);
+static Status make_render_url(char** relative_url_p, const char* base_path, const char* path);
+static Status make_summary(Page* page);
+static Status output_page_images(Site* site, Page* page);
 static Status parse_frontmatter(Page* page);
+static Status push_dir(WalkDir** dirs_p, size_t* dir_count_p, WalkDir* dir_p);
+static Status read_stdin(char** markdown_p);
+static Status render_page(char** page_html_p, Site* site, Page* page);
 
-static struct {
-    Page *pages;
-} g;
+// Opened by the command line for --live, the only mode that asks a browser to show a page.
+struct Library* OpenURLBase;
 
-Status page_init(void) {
+Status page_init(Site* site) {
     TRY
-    CHECK(vector_new(&g.pages, sizeof(Page), 0));
+    CHECK(vector_new(&site->pages, sizeof(Page), 0));
+    CHECK(vector_new(&site->feed_pages, sizeof(size_t), 0));
+    CHECK(tags_init(site));
 
     FINALLY RETURN;
 }
 
-void page_fini(void) {
-    if (g.pages) {
-        vector_foreach(g.pages, Page, page) {
-            string_free(&page->markdown_path);
-            string_free(&page->dir_path);
-            string_free(&page->relative_url);
-            string_free(&page->title);
-            string_free(&page->date);
-            string_free(&page->description);
-            free_elements(&page->children);
+void page_fini(Site* site) {
+    tags_fini(site);
+    vector_free(&site->feed_pages);
+
+    if (site->pages) {
+        vector_foreach(site->pages, Page, page) {
+            page_free(page);
         }
 
-        vector_free(&g.pages);
+        vector_free(&site->pages);
+    }
+}
+
+void page_free(Page* page) {
+    string_free(&page->markdown_path);
+    string_free(&page->dir_path);
+    string_free(&page->relative_url);
+    string_free(&page->title);
+    string_free(&page->date);
+    string_free(&page->description);
+    free_strings(&page->tags);
+    string_free(&page->full_title);
+    string_free(&page->breadcrumb);
+    string_free(&page->summary);
+    string_free(&page->terms);
+    string_free(&page->feed_html);
+    free_strings(&page->image_urls);
+    free_nodes(page);
+}
+
+static void free_nodes(Page* page) {
+    if (page->nodes) {
+        vector_free(&page->nodes);
     }
+
+    string_free(&page->source);
 }
 
-static void free_elements(Element** elements_p) {
-    if (*elements_p) {
-        vector_foreach(*elements_p, Element, element) {
-            string_free(&element->text);
-            string_free(&element->url);
-            free_elements(&element->children);
+static void free_strings(char*** strings_p) {
+    if (*strings_p) {
+        vector_foreach(*strings_p, char*, string_p) {
+            string_free(string_p);
         }
 
-        vector_free(elements_p);
+        vector_free(strings_p);
     }
 }
 
-Status page_build_all(const char* base_path) {
+// Files are written through site->output, and what was built is left in result for the caller to
+// report.
+Status page_build_all(BuildResult* result, Site* site, const BuildOptions* options) {
     TRY
     char* file_path = NULL;
     char* text = NULL;
+    PageViews views = {0};
+
+    // Pages are only tokenized for the search index when it is wanted.
+    site->search_index = options->search_index;
+    site->feed_item_count = options->feed_item_count;
+    site->feed_content_size = options->feed_content_size;
 
-    CHECK(build_all_pages(base_path, "", NULL, NULL));
+    stats_begin(SS_Walk);
+    CHECK(build_all_pages(site, site->base_path, NULL));
+    stats_end();
 
-    CHECK(string_path_join(&file_path, base_path, "index.html"));
-    CHECK(html_generate_root(&text, g.pages));
-    CHECK(file_write(text, file_path));
+    stats_begin(SS_Root);
+    CHECK(views_build(&views, site->pages));
+
+    size_t post_count = vector_length(views.posts);
+    size_t root_post_count = post_count;
+    uint archive_page_count = 0;
+
+    if (options->index_post_count > 0) {
+        root_post_count = MIN(post_count, options->index_post_count);
+        archive_page_count = (post_count - root_post_count + options->index_post_count - 1) / options->index_post_count;
+    }
+
+    CHECK(string_path_join(&file_path, site->base_path, "index.html"));
+    CHECK(html_generate_root(&text, site, &views, root_post_count, archive_page_count));
+    stats_end();
+    CHECK(output_write(site->output, text, file_path));
 
     string_free(&text);
     string_free(&file_path);
 
-    CHECK(string_path_join(&file_path, base_path, "index.xml"));
-    CHECK(rss_generate(&text, g.pages));
-    CHECK(file_write(text, file_path));
+    CHECK(string_path_join(&file_path, site->base_path, "index.xml"));
+    stats_begin(SS_Feed);
+    CHECK(rss_generate(&text, site->pages, &views, options->feed_item_count));
+    stats_end();
+    CHECK(output_write(site->output, text, file_path));
+    memory_sample();
+
+    if (archive_page_count > 0) {
+        CHECK(build_archive_pages(site, &views, root_post_count, options->index_post_count));
+    }
+
+    stats_begin(SS_Root);
+    CHECK(tags_build_pages(site));
+    stats_end();
+
+    if (options->search_index) {
+        stats_begin(SS_Search);
+        CHECK(search_write_index(result, site));
+        stats_end();
+    }
+
+    CHECK(cache_write_sizes(site));
+
+    result->page_count = vector_length(site->pages);
 
     FINALLY
+    views_free(&views);
     string_free(&text);
     string_free(&file_path);
     
     RETURN;
 }
 
-Status page_build_live(const char* base_path) {
+// Posts that do not fit on the root page are split into archive pages numbered from the oldest post,
+// so adding a post changes only the newest archive page and the others are left untouched on disk.
+static Status build_archive_pages(Site* site, PageViews* views, size_t root_post_count, uint posts_per_page) {
+    TRY
+    char* archive_path = NULL;
+    char* html_path = NULL;
+    char* text = NULL;
+
+    size_t* archive_posts = &views->posts[root_post_count];
+    size_t archive_post_count = vector_length(views->posts) - root_post_count;
+    uint page_count = (archive_post_count + posts_per_page - 1) / posts_per_page;
+
+    CHECK(string_path_join(&archive_path, site->base_path, "archive"));
+    CHECK(output_make_dir(site->output, archive_path));
+
+    for (uint page_number = 1; page_number <= page_count; ++ page_number) {
+        size_t end_index = archive_post_count - ((page_number - 1) * posts_per_page);
+        size_t start_index = (page_number < page_count) ? (end_index - posts_per_page) : 0;
+
+        CHECK(string_printf(&html_path, "%s/page-%u", archive_path, page_number));
+        CHECK(output_make_dir(site->output, html_path));
+        CHECK(string_path_append(&html_path, "index.html"));
+
+        stats_begin(SS_Root);
+        CHECK(html_generate_archive(&text, site, &archive_posts[start_index], end_index - start_index,
+            page_number, page_count));
+        stats_end();
+        CHECK(output_write_changed(site->output, text, html_path));
+
+        string_free(&text);
+        string_free(&html_path);
+    }
+
+    // Pages beyond the last are left from a build with more posts or fewer per page.
+    for (uint page_number = page_count + 1;; ++ page_number) {
+        struct stat path_stat;
+
+        CHECK(string_printf(&html_path, "%s/page-%u", archive_path, page_number));
+
+        if (stat(html_path, &path_stat) != 0) {
+            break;
+        }
+
+        CHECK(output_remove_page(site->output, html_path));
+        string_free(&html_path);
+    }
+
+    FINALLY
+    string_free(&text);
+    string_free(&html_path);
+    string_free(&archive_path);
+
+    RETURN;
+}
+
+Status page_build_live(Site* site) {
     TRY
     char* live_path = NULL;
     char* live_url = NULL;
-    char* real_base_path = NULL;
-    char* real_live_path = NULL;
 
     CHECK(rexx_get_live_path(&live_path));
 
     if (live_path) {
-        CHECK(get_real_path(&real_base_path, base_path));
-        CHECK(get_real_path(&real_live_path, live_path));
-        CHECK(build_all_pages(real_base_path, "", real_live_path, NULL));
+        CHECK(page_build_one(site, live_path));
 
-        Page* live_page = &vector_last(g.pages);
+        Page* live_page = &vector_last(site->pages);
 
-        CHECK(get_live_url(&live_url, live_page->dir_path, base_path));
+        CHECK(get_live_url(&live_url, live_page->dir_path, site->base_path));
         URL_Open(live_url, TAG_DONE);
         string_free(&live_url);
     }
 
     FINALLY
-    string_free(&real_live_path);
-    string_free(&real_base_path);
     string_free(&live_url);
     string_free(&live_path);
 
     RETURN;
 }
 
-static Status build_all_pages(const char* dir_path, const char* dir_url, const char* filter_path, Page* parent) {
+// Builds the page at markdown_path, reading only the front matter of its ancestors. The built page
+// is left last in the site's pages.
+Status page_build_one(Site* site, const char* markdown_path) {
     TRY
-    DIR* dir = NULL;
-    char* sub_path = NULL;
-    char* sub_url = NULL;
+    char* real_base_path = NULL;
+    char* real_markdown_path = NULL;
+
+    CHECK(file_real_path(&real_base_path, site->base_path));
+    CHECK(file_real_path(&real_markdown_path, markdown_path));
+    stats_begin(SS_Walk);
+    CHECK(build_all_pages(site, real_base_path, real_markdown_path));
+    stats_end();
+
+    FINALLY
+    string_free(&real_markdown_path);
+    string_free(&real_base_path);
+
+    RETURN;
+}
+
+// Renders the Markdown on stdin as the page at path to stdout, for editors to pipe a page through as
+// it is written. path is the page's index.md or its directory, within BASEDIR or relative to it, and
+// need not exist yet. The site is not scanned: only the front matter of the page's ancestors is read,
+// and nothing is written to disk.
+Status page_render_stdin(Site* site, const char* path) {
+    TRY
+    char* markdown = NULL;
+    char* relative_url = NULL;
+    char* page_html = NULL;
+
+    CHECK(read_stdin(&markdown));
+    CHECK(make_render_url(&relative_url, site->base_path, path));
+
+    stats_begin(SS_Walk);
+    CHECK(add_ancestors(site, relative_url));
+    stats_end();
+
+    CHECK(site_render(&page_html, site, markdown, relative_url));
+    ASSERT(fwrite(page_html, 1, string_length(page_html), stdout) == string_length(page_html), "Cannot write page");
+    fflush(stdout);
+
+    FINALLY
+    string_free(&page_html);
+    string_free(&relative_url);
+    string_free(&markdown);
+
+    RETURN;
+}
+
+// Reads the front matter of every page in the site, leaving their content to page_render.
+Status page_scan_all(Site* site) {
+    TRY
+    site->scan_only = true;
+    CHECK(build_all_pages(site, site->base_path, NULL));
+
+    FINALLY
+    site->scan_only = false;
+
+    RETURN;
+}
+
+// Renders a page without writing anything. Its front matter and any memoized title are read again,
+// as the Markdown may have changed since the page was scanned.
+Status page_render(char** page_html_p, Site* site, Page* page) {
+    TRY
+    string_free(&page->title);
+    string_free(&page->date);
+    string_free(&page->description);
+    free_strings(&page->tags);
+    string_free(&page->full_title);
+    string_free(&page->breadcrumb);
+    string_free(&page->summary);
+    string_free(&page->terms);
+    string_free(&page->feed_html);
+    free_strings(&page->image_urls);
+
+    CHECK(render_page(page_html_p, site, page));
+
+    FINALLY
+    free_nodes(page);
+
+    RETURN;
+}
+
+// Adds each page above relative_url in turn from the top, with just its front matter, so that the
+// page finds them as its ancestors. Directories without an index.md are passed over as in a build.
+static Status add_ancestors(Site* site, const char* relative_url) {
+    TRY
+    char* ancestor_url = NULL;
+    char* markdown_path = NULL;
     struct stat path_stat;
-    Page* index_page = NULL;
+    size_t parent_index = PAGE_INDEX_NONE;
 
-    CHECK(string_path_join(&sub_path, dir_path, "index.md"));
+    for (const char* url_end = relative_url; url_end; url_end = strchr(url_end, '/')) {
+        if (url_end != relative_url) {
+            ++ url_end;
+        }
 
-    if (stat(sub_path, &path_stat) == 0) {
-        CHECK(vector_append(&g.pages, 1, NULL));
-        index_page = &g.pages[vector_length(g.pages) - 1];
+        if (*url_end == '\0') {
+            break;
+        }
 
-        SWAP(index_page->markdown_path, sub_path);
-        CHECK(string_clone(&index_page->dir_path, dir_path));
-        CHECK(string_clone(&index_page->relative_url, dir_url));
-        CHECK(vector_new(&index_page->children, sizeof(Element), 0));
+        CHECK(string_clone_substr(&ancestor_url, relative_url, url_end - relative_url));
+        CHECK(string_path_join(&markdown_path, site->base_path, ancestor_url));
+        CHECK(string_path_append(&markdown_path, "index.md"));
 
-        index_page->add_to_index = string_startswith(dir_url, "posts/") || (string_count_substr(dir_url, "/") == 1);
-        index_page->parent = parent;
+        if (stat(markdown_path, &path_stat) == 0) {
+            CHECK(vector_append(&site->pages, 1, NULL));
+            Page* ancestor = &vector_last(site->pages);
 
-        if ((! filter_path) || (strcmp(index_page->markdown_path, filter_path) == 0)) {
-            CHECK(build_page(index_page));
-        } else {
-            CHECK(parse_frontmatter(index_page));
+            SWAP(ancestor->markdown_path, markdown_path);
+            SWAP(ancestor->relative_url, ancestor_url);
+            CHECK(string_path_join(&ancestor->dir_path, site->base_path, ancestor->relative_url));
+            ancestor->parent_index = parent_index;
+            parent_index = vector_length(site->pages) - 1;
+
+            CHECK(parse_frontmatter(ancestor));
         }
+
+        string_free(&markdown_path);
+        string_free(&ancestor_url);
     }
 
-    string_free(&sub_path);
+    FINALLY
+    string_free(&markdown_path);
+    string_free(&ancestor_url);
 
-    ASSERT(dir = opendir(dir_path), "%s is not a directory", dir_path);
+    RETURN;
+}
 
-    for (struct dirent* dir_ent; (dir_ent = readdir(dir));) {
-        CHECK(string_path_join(&sub_path, dir_path, dir_ent->d_name));
+// Pages are added as a depth-first walk in name order meets them, each directory's page before those
+// below it, so that page order and archive layout do not depend on the filesystem. The walk keeps a
+// stack of directories still to visit rather than recursing, and ExAll lists each one with the type
+// and size of every entry, so nothing below BASEDIR is examined on its own.
+static Status build_all_pages(Site* site, const char* base_path, const char* filter_path) {
+    TRY
+    WalkDir* dirs = NULL;
+    WalkEntry* entries = NULL;
+    WalkDir dir = {NULL, NULL, PAGE_INDEX_NONE};
+    ULONG* buffer = NULL;
+    struct ExAllControl* control = NULL;
+    size_t dir_count = 0;
+
+    CHECK(vector_new(&dirs, sizeof(WalkDir), 0));
+    CHECK(vector_new(&buffer, sizeof(ULONG), EXALL_BUFFER_SIZE / sizeof(ULONG)));
+    ASSERT(control = AllocDosObject(DOS_EXALLCONTROL, NULL));
+
+    CHECK(string_clone(&dir.path, base_path));
+    CHECK(string_clone(&dir.url, ""));
+    CHECK(push_dir(&dirs, &dir_count, &dir));
+
+    while (dir_count > 0) {
+        size_t page_index = PAGE_INDEX_NONE;
+
+        // The stack only grows, and the directories on it are the first dir_count.
+        dir = dirs[-- dir_count];
+        dirs[dir_count].path = NULL;
+        dirs[dir_count].url = NULL;
+
+        CHECK(list_dir(&entries, control, buffer, dir.path));
+
+        vector_foreach(entries, WalkEntry, entry) {
+            if (! entry->is_dir) {
+                // Pages refer to their parent by index, as appending to site->pages may move every page in memory.
+                page_index = vector_length(site->pages);
+                CHECK(vector_append(&site->pages, 1, NULL));
+                Page* index_page = &site->pages[page_index];
+
+                CHECK(string_path_join(&index_page->markdown_path, dir.path, "index.md"));
+                CHECK(string_clone(&index_page->dir_path, dir.path));
+                CHECK(string_clone(&index_page->relative_url, dir.url));
+
+                index_page->add_to_index = string_startswith(dir.url, "posts/") || (string_count_substr(dir.url, "/") == 1);
+                index_page->parent_index = dir.parent_index;
+
+                if ((! site->scan_only) && ((! filter_path) || (strcmp(index_page->markdown_path, filter_path) == 0))) {
+                    CHECK(build_page(site, index_page, entry->size));
+                } else {
+                    CHECK(parse_frontmatter(index_page));
+                }
+
+                // The tag index is filled in by the same walk that reads each page's front matter.
+                CHECK(tags_add_page(site, page_index));
+                break;
+            }
+        }
+
+        // Subdirectories are pushed last first, so that the first in name order is visited next.
+        for (size_t entry_index = vector_length(entries); entry_index > 0; -- entry_index) {
+            WalkEntry* entry = &entries[entry_index - 1];
+            WalkDir sub_dir = {NULL, NULL, (page_index != PAGE_INDEX_NONE) ? page_index : dir.parent_index};
+
+            if (! entry->is_dir) {
+                continue;
+            }
 
-        ASSERT(stat(sub_path, &path_stat) == 0, "Cannot stat %s", dir_ent->d_name);
+            CHECK(string_path_join(&sub_dir.path, dir.path, entry->name));
 
-        if (S_ISDIR(path_stat.st_mode)) {
-            if ((! filter_path) || string_startswith(filter_path, sub_path)) {
-                CHECK(string_printf(&sub_url, "%s%s/", dir_url, dir_ent->d_name));
-                CHECK(build_all_pages(sub_path, sub_url, filter_path, index_page ? index_page : parent));
-                string_free(&sub_url);
+            if ((! filter_path) || string_startswith(filter_path, sub_dir.path)) {
+                CHECK(string_printf(&sub_dir.url, "%s%s/", dir.url, entry->name));
+                CHECK(push_dir(&dirs, &dir_count, &sub_dir));
             }
+
+            string_free(&sub_dir.path);
         }
 
-        string_free(&sub_path);
+        free_entries(&entries);
+        string_free(&dir.url);
+        string_free(&dir.path);
     }
 
     FINALLY
-    string_free(&sub_url);
-    string_free(&sub_path);
+    free_entries(&entries);
+    string_free(&dir.url);
+    string_free(&dir.path);
+
+    if (dirs) {
+        vector_foreach(dirs, WalkDir, walk_dir) {
+            string_free(&walk_dir->url);
+            string_free(&walk_dir->path);
+        }
 
-    if (dir) {
-        closedir(dir);
+        vector_free(&dirs);
+    }
+
+    if (control) {
+        FreeDosObject(DOS_EXALLCONTROL, control);
+    }
+
+    if (buffer) {
+        vector_free(&buffer);
     }
 
     RETURN;
 }
 
+// Takes the directory's strings, leaving *dir_p empty.
+static Status push_dir(WalkDir** dirs_p, size_t* dir_count_p, WalkDir* dir_p) {
+    TRY
+    if (*dir_count_p == vector_length(*dirs_p)) {
+        CHECK(vector_append(dirs_p, 1, NULL));
+    }
+
+    (*dirs_p)[(*dir_count_p) ++] = *dir_p;
+    dir_p->path = NULL;
+    dir_p->url = NULL;
+
+    FINALLY RETURN;
+}
+
+// Fills *entries_p with the directories in dir_path and its index.md, if any, in name order. ExAll
+// fills the buffer with as many entries as fit on each call. Links to directories are followed as
+// stat would, which takes a lock of their own.
+static Status list_dir(WalkEntry** entries_p, struct ExAllControl* control, ULONG* buffer, const char* dir_path) {
+    TRY
+    BPTR lock = 0;
+    struct stat path_stat;
+    char* link_path = NULL;
+    bool more = true;
+
+    CHECK(vector_new(entries_p, sizeof(WalkEntry), 0));
+    ASSERT(lock = Lock(dir_path, ACCESS_READ), "%s is not a directory", dir_path);
+
+    control->eac_LastKey = 0;
+    control->eac_MatchString = NULL;
+    control->eac_MatchFunc = NULL;
+
+    while (more) {
+        more = ExAll(lock, (struct ExAllData*)buffer, EXALL_BUFFER_SIZE, ED_SIZE, control);
+        ASSERT(more || (IoErr() == ERROR_NO_MORE_ENTRIES), "Cannot list %s", dir_path);
+
+        for (struct ExAllData* data = (control->eac_Entries > 0) ? (struct ExAllData*)buffer : NULL; data;
+            data = data->ed_Next)
+        {
+            WalkEntry entry = {NULL, data->ed_Size, (data->ed_Type > 0) && (data->ed_Type != ST_SOFTLINK)};
+
+            if (data->ed_Type == ST_SOFTLINK) {
+                CHECK(string_path_join(&link_path, dir_path, (const char*)data->ed_Name));
+                entry.is_dir = (stat(link_path, &path_stat) == 0) && S_ISDIR(path_stat.st_mode);
+                string_free(&link_path);
+            }
+
+            // File names are not case sensitive, so INDEX.MD is a page as well.
+            if (entry.is_dir || (Stricmp((const char*)data->ed_Name, "index.md") == 0)) {
+                CHECK(vector_append(entries_p, 1, NULL));
+                CHECK(string_clone(&vector_last(*entries_p).name, (const char*)data->ed_Name));
+                vector_last(*entries_p).size = entry.size;
+                vector_last(*entries_p).is_dir = entry.is_dir;
+            }
+        }
+    }
+
+    qsort(*entries_p, vector_length(*entries_p), sizeof(WalkEntry), entry_name_compare);
+
+    FINALLY
+    string_free(&link_path);
+
+    if (lock) {
+        // A scan given up part way must be ended before the directory is unlocked.
+        if (more) {
+            ExAllEnd(lock, (struct ExAllData*)buffer, EXALL_BUFFER_SIZE, ED_SIZE, control);
+        }
+
+        UnLock(lock);
+    }
+
+    RETURN;
+}
+
+static void free_entries(WalkEntry** entries_p) {
+    if (*entries_p) {
+        vector_foreach(*entries_p, WalkEntry, entry) {
+            string_free(&entry->name);
+        }
+
+        vector_free(entries_p);
+    }
+}
+
 static Status parse_frontmatter(Page* page) {
     TRY
     char* text_markdown = NULL;
 
+    trace_begin("parse_frontmatter", page->markdown_path);
+
     CHECK(file_read(&text_markdown, page->markdown_path));
-    CHECK(markdown_parse_frontmatter(text_markdown, page));
+    CHECK(markdown_parse_frontmatter(text_markdown, page, NULL));
+    stats_count(SC_PagesScanned, 1);
 
     FINALLY
     string_free(&text_markdown);
+    trace_end();
 
     RETURN;
 }
 
-static Status build_page(Page* page) {
+static Status build_page(Site* site, Page* page, size_t markdown_size) {
     TRY
-    char* text_markdown = NULL;
     char* text_html = NULL;
     char* html_path = NULL;
 
-    CHECK(file_read(&text_markdown, page->markdown_path));
-    CHECK(markdown_parse_all(text_markdown, page));
-
-    CHECK(html_generate(&text_html, page));
+    stats_page_begin(page->markdown_path);
 
     CHECK(string_clone_substr(&html_path, page->markdown_path, string_length(page->markdown_path) - 2));
     CHECK(string_append(&html_path, "html"));
-    CHECK(file_write(text_html, html_path));
+
+    if (markdown_size >= CHUNK_MIN_PAGE_SIZE) {
+        CHECK(build_page_in_chunks(site, page, html_path));
+    } else {
+        CHECK(render_page(&text_html, site, page));
+        CHECK(output_write(site->output, text_html, html_path));
+    }
+
+    CHECK(output_page_images(site, page));
+
+    stats_count(SC_PagesBuilt, 1);
+    CHECK(stats_page_end(page->markdown_path));
 
     FINALLY
+    free_nodes(page);
+    free_strings(&page->image_urls);
     string_free(&html_path);
     string_free(&text_html);
-    string_free(&text_markdown);
 
     RETURN;
 }
 
+// Large pages are read, parsed and written a chunk at a time, so the memory they need depends on the
+// chunk size and their longest line rather than their size. Each chunk ends with a whole line, and
+// what the parser leaves of it starts the next. The body cache needs the whole body, so these pages
+// are always rendered, and their summary comes from the first chunk.
+static Status build_page_in_chunks(Site* site, Page* page, const char* html_path) {
+    TRY
+    FILE* file = NULL;
+    char* html = NULL;
+    char* larger_source = NULL;
+    OutputFile output_file = {0};
+    MarkdownState state = {0};
+    size_t source_size = CHUNK_SIZE;
+    size_t source_length = 0;
+    uint indent = 0;
+    bool is_first = true;
+
+    ASSERT(file = fopen(page->markdown_path, "rb"), "Error accessing file %s", page->markdown_path);
+    CHECK(string_new(&page->source, source_size));
+    CHECK(output_begin(site->output, &output_file, html_path));
+
+    for (bool is_last = false; ! is_last;) {
+        if (source_length == source_size) {
+            CHECK(string_new(&larger_source, source_size * 2));
+            memcpy(larger_source, page->source, source_length);
+            SWAP(page->source, larger_source);
+            string_free(&larger_source);
+            source_size *= 2;
+        }
+
+        stats_begin(SS_Read);
+        size_t read_length = fread(&page->source[source_length], 1, source_size - source_length, file);
+        stats_count(SC_BytesRead, read_length);
+        stats_end();
+
+        ASSERT(! ferror(file), "Error accessing file %s", page->markdown_path);
+        source_length += read_length;
+        page->source[source_length] = '\0';
+        is_last = feof(file);
+
+        size_t chunk_length = is_last ? source_length : find_chunk_end(page->source, source_length);
+
+        // The front matter is parsed whole from the first chunk, which must run past its end for it to
+        // count as closed.
+        if (is_first && (chunk_length > 0) && (! is_last) && (strncmp(page->source, "---\n", 4) == 0)) {
+            const char* matter_end = strstr(page->source, "\n---\n");
+
+            if ((! matter_end) || (matter_end + 5 >= &page->source[chunk_length])) {
+                chunk_length = 0;
+            }
+        }
+
+        if ((chunk_length == 0) && (! is_last)) {
+            continue;
+        }
+
+        char next_char = page->source[chunk_length];
+        const char* content = page->source;
+        size_t parsed_length = 0;
+
+        page->source[chunk_length] = '\0';
+
+        if (is_first) {
+            CHECK(markdown_parse_frontmatter(page->source, page, &content));
+            CHECK(html_generate_page_start(&html, site, page, &indent));
+        }
+
+        CHECK(vector_new(&page->nodes, sizeof(Node), 0));
+
+        stats_begin(SS_Parse);
+        CHECK(markdown_parse_chunk(content, page, &state, is_last, &parsed_length));
+        stats_end();
+
+        stats_begin(SS_Render);
+        CHECK(html_generate_nodes(&html, site, page, &indent));
+
+        if (is_last) {
+            CHECK(html_generate_page_end(&html, site, page));
+        }
+
+        stats_end();
+
+        CHECK(output_append(site->output, &output_file, html));
+        CHECK(string_truncate(&html, 0));
+
+        if (is_first) {
+            CHECK(make_summary(page));
+        }
+
+        CHECK(make_image_urls(page));
+
+        if (site->search_index) {
+            stats_begin(SS_Search);
+            CHECK(search_make_terms(page));
+            stats_end();
+        }
+
+        memory_sample();
+        vector_free(&page->nodes);
+
+        size_t used_length = (content - page->source) + parsed_length;
+
+        page->source[chunk_length] = next_char;
+        memmove(page->source, &page->source[used_length], source_length - used_length);
+        source_length -= used_length;
+        is_first = false;
+    }
+
+    CHECK(output_end(site->output, &output_file));
+
+    FINALLY
+    output_free(&output_file);
+
+    if (file) {
+        fclose(file);
+    }
+
+    string_free(&larger_source);
+    string_free(&html);
+
+    RETURN;
+}
+
+// The length of text up to and including its last newline that is not escaped, or 0 if there is none.
+static size_t find_chunk_end(const char* text, size_t length) {
+    for (size_t end = length; end > 0; -- end) {
+        if ((text[end - 1] == '\n') && ((end == 1) || (text[end - 2] != '\\'))) {
+            return end;
+        }
+    }
+
+    return 0;
+}
+
+static Status read_stdin(char** markdown_p) {
+    TRY
+    char* buffer = NULL;
+    size_t read_size = 0;
+
+    CHECK(string_new(markdown_p, 0));
+    CHECK(string_new(&buffer, CHUNK_SIZE));
+
+    while ((read_size = fread(buffer, 1, CHUNK_SIZE, stdin)) > 0) {
+        buffer[read_size] = '\0';
+        CHECK(string_append(markdown_p, buffer));
+    }
+
+    ASSERT(! ferror(stdin), "Cannot read Markdown from stdin");
+    stats_count(SC_BytesRead, string_length(*markdown_p));
+
+    FINALLY
+    string_free(&buffer);
+
+    RETURN;
+}
+
+// The body is taken from the cache when the page's content and ancestors are unchanged, so that a
+// template edit only fills in page.html again. Either way the page is left with the summary and image
+// URLs that the feed and the output need, and its nodes when it was parsed.
+static Status render_page(char** page_html_p, Site* site, Page* page) {
+    TRY
+    char* body_html = NULL;
+    const char* content = NULL;
+
+    // Nodes refer to the page's text by offset, so the page keeps it until they are freed.
+    CHECK(file_read(&page->source, page->markdown_path));
+
+    stats_begin(SS_Parse);
+    CHECK(markdown_parse_frontmatter(page->source, page, &content));
+    stats_end();
+
+    CHECK(cache_read(&body_html, site, page, page->source));
+
+    if (! body_html) {
+        stats_begin(SS_Parse);
+        CHECK(cache_read_nodes(site, page));
+
+        if (! page->nodes) {
+            CHECK(vector_new(&page->nodes, sizeof(Node), 0));
+            CHECK(markdown_parse_content(content, page));
+            CHECK(cache_write_nodes(site, page));
+        }
+
+        stats_end();
+
+        stats_begin(SS_Render);
+        CHECK(html_generate_body(&body_html, site, page));
+        stats_end();
+
+        CHECK(make_summary(page));
+        CHECK(make_image_urls(page));
+
+        if (site->search_index) {
+            stats_begin(SS_Search);
+            CHECK(search_make_terms(page));
+            stats_end();
+        }
+
+        CHECK(cache_write(body_html, site, page, page->source));
+    }
+
+    CHECK(keep_feed_html(site, page, body_html));
+
+    stats_begin(SS_Render);
+    CHECK(html_generate_page(page_html_p, site, page, body_html));
+    stats_end();
+    memory_sample();
+
+    FINALLY
+    string_free(&body_html);
+
+    RETURN;
+}
+
+// A URL ends in a slash, except for the top page's, which is empty. What is left of the path once
+// BASEDIR is taken off must lead nowhere else: a colon names a volume, and on AmigaDOS a leading slash
+// or one after another names a parent directory.
+static Status make_render_url(char** relative_url_p, const char* base_path, const char* path) {
+    TRY
+    size_t base_length = strlen(base_path);
+    const char* url = path;
+
+    if ((strncmp(path, base_path, base_length) == 0) && ((path[base_length] == '\0') || (path[base_length] == '/') ||
+        string_endswith(base_path, "/") || string_endswith(base_path, ":")))
+    {
+        url = &path[base_length];
+        url += (*url == '/');
+    }
+
+    ASSERT((url[0] != '/') && (! strchr(url, ':')) && (! strstr(url, "//")) && (! strstr(url, "..")),
+        "%s is not within BASEDIR", path);
+
+    CHECK(string_clone(relative_url_p, url));
+
+    if (string_endswith(*relative_url_p, "index.md")) {
+        CHECK(string_truncate(relative_url_p, string_length(*relative_url_p) - strlen("index.md")));
+    }
+
+    if ((string_length(*relative_url_p) > 0) && (! string_endswith(*relative_url_p, "/"))) {
+        CHECK(string_append(relative_url_p, "/"));
+    }
+
+    FINALLY RETURN;
+}
+
+// The summary is the text of the first paragraph, links and bold included.
+static Status make_summary(Page* page) {
+    TRY
+    if (! page->description) {
+        CHECK(string_new(&page->summary, 0));
+
+        bool in_paragraph = false;
+
+        vector_foreach(page->nodes, Node, node) {
+            if (node->type == ET_Paragraph) {
+                if (in_paragraph) {
+                    break;
+                }
+
+                in_paragraph = true;
+            } else if (in_paragraph && (node->kind == NK_Text)) {
+                CHECK(html_append_text(&page->summary, &page->source[node->text_offset], node->text_length, true));
+            }
+        }
+    }
+
+    FINALLY RETURN;
+}
+
+// Top-level pages are the feed's items, as in views_build. When the feed carries page content, only
+// the newest site->feed_item_count of those built so far are held in site->feed_pages, and each keeps
+// its content's HTML unless that is over site->feed_content_size bytes. A page pushed out of the cut
+// gives its copy up, so no more are held than the feed can use. Pages built in chunks never have a
+// whole body to take it from.
+static Status keep_feed_html(Site* site, Page* page, const char* body_html) {
+    TRY
+    string_free(&page->feed_html);
+
+    if ((site->feed_content_size == 0) || (page->parent_index != PAGE_INDEX_NONE)) {
+        THROW(StatusOK);
+    }
+
+    if (site->feed_item_count > 0) {
+        size_t page_index = page - site->pages;
+
+        if (vector_length(site->feed_pages) < site->feed_item_count) {
+            CHECK(vector_append(&site->feed_pages, 1, &page_index));
+        } else {
+            size_t* oldest_p = &site->feed_pages[0];
+
+            vector_foreach(site->feed_pages, size_t, feed_index_p) {
+                if (views_feed_precedes(site->pages, *oldest_p, *feed_index_p)) {
+                    oldest_p = feed_index_p;
+                }
+            }
+
+            if (! views_feed_precedes(site->pages, page_index, *oldest_p)) {
+                THROW(StatusOK);
+            }
+
+            string_free(&site->pages[*oldest_p].feed_html);
+            *oldest_p = page_index;
+        }
+    }
+
+    if (page->content_length <= site->feed_content_size) {
+        CHECK(string_clone_substr(&page->feed_html, &body_html[page->content_offset], page->content_length));
+    }
+
+    FINALLY RETURN;
+}
+
+// Adds to any URLs already made, as pages built in chunks make them a chunk at a time.
+static Status make_image_urls(Page* page) {
+    TRY
+    if (! page->image_urls) {
+        CHECK(vector_new(&page->image_urls, sizeof(char*), 0));
+    }
+
+    vector_foreach(page->nodes, Node, node) {
+        if ((node->kind == NK_Open) && (node->type == ET_Image)) {
+            CHECK(vector_append(&page->image_urls, 1, NULL));
+            CHECK(string_new(&vector_last(page->image_urls), 0));
+            CHECK(html_append_text(&vector_last(page->image_urls), &page->source[node->url_offset],
+                node->url_length, true));
+        }
+    }
+
+    FINALLY RETURN;
+}
+
+static Status output_page_images(Site* site, Page* page) {
+    TRY
+    char* half_file_name = NULL;
+    char* image_path = NULL;
+
+    vector_foreach(page->image_urls, char*, url_p) {
+        CHECK(string_path_join(&image_path, page->dir_path, *url_p));
+        CHECK(output_add_file(site->output, image_path));
+        string_free(&image_path);
+
+        CHECK(make_half_file_name(&half_file_name, *url_p));
+        CHECK(string_path_join(&image_path, page->dir_path, half_file_name));
+        CHECK(output_add_file(site->output, image_path));
+        string_free(&image_path);
+        string_free(&half_file_name);
+    }
+
+    FINALLY
+    string_free(&image_path);
+    string_free(&half_file_name);
+
+    RETURN;
+}
+
+static int entry_name_compare(const void* entry1_p, const void* entry2_p) {
+    return strcmp(((const WalkEntry*)entry1_p)->name, ((const WalkEntry*)entry2_p)->name);
+}
+
 static Status get_live_url(char** live_url_p, const char* dir_path, const char* base_path) {
     TRY
     char* real_dir_path = NULL;
     char* real_base_path = NULL;
 
-    CHECK(get_real_path(&real_dir_path, dir_path));
-    CHECK(get_real_path(&real_base_path, base_path));
+    CHECK(file_real_path(&real_dir_path, dir_path));
+    CHECK(file_real_path(&real_base_path, base_path));
 
     size_t real_base_len = string_length(real_base_path);
 
@@ -228,19 +1004,3 @@ static Status get_live_url(char** live_url_p, const char* dir_path, const char*
 
     RETURN;
 }
-
-static Status get_real_path(char** real_path_p, const char* path) {
-    TRY
-    BPTR lock = 0;
-
-    ASSERT(lock = Lock(path, ACCESS_READ));
-
-    CHECK(string_new(real_path_p, PATH_MAX));
-    ASSERT(NameFromLock(lock, *real_path_p, PATH_MAX));
-    CHECK(string_truncate(real_path_p, strlen(*real_path_p)));
-
-    FINALLY
-    UnLock(lock);
-
-    RETURN;
-}
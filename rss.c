@@ -2,27 +2,43 @@
 
 #include <time.h>
 
+static Status append_cdata(char** html_p, char* text);
 static Status make_rss_date(char** date_str_p, Page* page);
-static int page_compare(const void* page1_p, const void* page2_p);
 static uint week_day(uint day, uint month, uint year);
 
-Status rss_generate(char** html_p, Page* pages) {
+// Items whose page kept its content's HTML in feed_html carry it in content:encoded, so that readers
+// need not fetch the page. Links and images in it are relative to the page, given as its xml:base.
+Status rss_generate(char** html_p, Page* pages, PageViews* views, uint item_count) {
     TRY
     char* date_str = NULL;
+    bool has_content = false;
+
+    size_t feed_length = vector_length(views->feed_items);
+
+    if (item_count > 0) {
+        feed_length = MIN(feed_length, item_count);
+    }
+
+    for (size_t item_index = 0; item_index < feed_length; ++ item_index) {
+        has_content = has_content || pages[views->feed_items[item_index]].feed_html;
+    }
 
     CHECK(string_new(html_p, 0));
-    CHECK(string_append_indent(html_p, "<rss xmlns:atom=\"http://www.w3.org/2005/Atom\" version=\"2.0\">\n", 0));
+
+    if (has_content) {
+        CHECK(string_append_indent(html_p, "<rss xmlns:atom=\"http://www.w3.org/2005/Atom\" "
+            "xmlns:content=\"http://purl.org/rss/1.0/modules/content/\" version=\"2.0\">\n", 0));
+    } else {
+        CHECK(string_append_indent(html_p, "<rss xmlns:atom=\"http://www.w3.org/2005/Atom\" version=\"2.0\">\n", 0));
+    }
+
     CHECK(string_append_indent(html_p, "<channel>\n", 1));
     CHECK(string_append_indent(html_p, "<title>Amiga Geek</title>\n", 2));
     CHECK(string_append_indent(html_p, "<link>https://amigageek.com/</link>\n", 2));
     CHECK(string_append_indent(html_p, "<description>Antiquated adventures of a nostalgic engineer</description>\n", 2));
 
-    qsort(pages, vector_length(pages), sizeof(Page), page_compare);
-
-    vector_foreach(pages, Page, page) {
-        if (page->parent) {
-            continue;
-        }
+    for (size_t item_index = 0; item_index < feed_length; ++ item_index) {
+        Page* page = &pages[views->feed_items[item_index]];
 
         CHECK(string_append_indent(html_p, "<item>\n", 2));
         CHECK(string_append_indent(html_p, "<title>", 3));
@@ -42,18 +58,20 @@ Status rss_generate(char** html_p, Page* pages) {
 
         if (page->description) {
             CHECK(string_append(html_p, page->description));
-        } else {
-            vector_foreach(page->children, Element, page_child) {
-                if (page_child->type == ET_Paragraph) {
-                    vector_foreach(page_child->children, Element, paragraph_child) {
-                        CHECK(string_append(html_p, paragraph_child->text));
-                    }
-                    break;
-                }
-            }
+        } else if (page->summary) {
+            CHECK(string_append(html_p, page->summary));
         }
 
         CHECK(string_append(html_p, "</description>\n"));
+
+        if (page->feed_html) {
+            CHECK(string_append_indent(html_p, "<content:encoded xml:base=\"https://amigageek.com/", 3));
+            CHECK(string_append(html_p, page->relative_url));
+            CHECK(string_append(html_p, "\"><![CDATA[\n"));
+            CHECK(append_cdata(html_p, page->feed_html));
+            CHECK(string_append_indent(html_p, "]]></content:encoded>\n", 3));
+        }
+
         CHECK(string_append_indent(html_p, "</item>\n", 2));
     }
 
@@ -66,8 +84,21 @@ Status rss_generate(char** html_p, Page* pages) {
     RETURN;
 }
 
-static int page_compare(const void* page1_p, const void* page2_p) {
-    return - strcmp(((Page*)page1_p)->date, ((Page*)page2_p)->date);
+// A CDATA section cannot hold "]]>", so the text is split into a new section after each "]]". Each
+// piece is ended in place for a moment so that it is appended without a copy.
+static Status append_cdata(char** html_p, char* text) {
+    TRY
+    for (char* cdata_end; (cdata_end = strstr(text, "]]>"));) {
+        cdata_end[2] = '\0';
+        CHECK(string_append(html_p, text));
+        cdata_end[2] = '>';
+        CHECK(string_append(html_p, "]]><![CDATA["));
+        text = cdata_end + 2;
+    }
+
+    CHECK(string_append(html_p, text));
+
+    FINALLY RETURN;
 }
 
 static Status make_rss_date(char** date_str_p, Page* page) {
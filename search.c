@@ -0,0 +1,320 @@
+#include "common.h"
+
+#define LINE_SIZE 64
+#define TERM_MIN_LENGTH 2
+#define TERM_MAX_LENGTH 32
+#define SHARD_NAMES "0abcdefghijklmnopqrstuvwxyz"
+
+typedef struct {
+    const char* term;
+    uint term_length;
+    uint doc_id;
+} Posting;
+
+static void add_words(char*** word_end_p, char** next_out_p, const char* text, size_t length);
+static int compare_postings(const void* posting1_p, const void* posting2_p);
+static int compare_words(const void* word1_p, const void* word2_p);
+static uint hash_word(const char* word);
+static bool is_prose(Page* page, size_t node_index);
+static bool same_term(const Posting* posting1, const Posting* posting2);
+static uint shard_index(char first_char);
+static Status write_shards(size_t* index_size_p, Output* output, const char* search_path, Posting* postings);
+
+// The index lives in BASEDIR/search. pages.txt lists one indexed page per line as its URL, a space
+// and its title, and a page's line number is its document ID. Each term is kept in the shard named
+// after its first character, 0.txt holding those starting with a digit, so a search script fetches
+// one small file per query. Shards list their terms in order, one per line, as the length of the
+// prefix shared with the previous term, a space, the rest of the term, a space and the IDs of the
+// pages containing it, each written as the difference from the one before and separated by commas.
+//
+// Terms are runs of ASCII letters and digits, lower-cased. Each page keeps its own sorted list, one
+// term per line, made when it is rendered and stored with its cache entry, so only edited pages are
+// tokenized again. Terms the page already has are kept, so a page built in chunks gathers the terms of
+// each in turn.
+Status search_make_terms(Page* page) {
+    TRY
+    char* words = NULL;
+    char** word_starts = NULL;
+    char** word_table = NULL;
+    const char* old_terms = page->terms ? page->terms : "";
+    size_t text_length = strlen(page->title) + strlen(old_terms) + 2;
+    size_t table_size = 1;
+
+    for (size_t node_index = 0; node_index < vector_length(page->nodes); ++ node_index) {
+        if (is_prose(page, node_index)) {
+            text_length += page->nodes[node_index].text_length + 1;
+        }
+    }
+
+    // Each word is stored with a newline and terminator, at most twice the text it came from, so
+    // that the words can be sorted in place and the unique ones appended as they are.
+    CHECK(string_new(&words, text_length * 2));
+    CHECK(vector_new(&word_starts, sizeof(char*), 0));
+    CHECK(vector_append(&word_starts, text_length / (TERM_MIN_LENGTH + 1) + 1, NULL));
+
+    char** word_end = word_starts;
+    char* next_out = words;
+
+    add_words(&word_end, &next_out, old_terms, strlen(old_terms));
+    add_words(&word_end, &next_out, page->title, strlen(page->title));
+
+    for (size_t node_index = 0; node_index < vector_length(page->nodes); ++ node_index) {
+        if (is_prose(page, node_index)) {
+            add_words(&word_end, &next_out, &page->source[page->nodes[node_index].text_offset],
+                page->nodes[node_index].text_length);
+        }
+    }
+
+    // Most words repeat, so duplicates are dropped through an open addressing table before the
+    // remaining ones are sorted. The table is at most half full.
+    size_t word_count = word_end - word_starts;
+    size_t unique_count = 0;
+
+    while (table_size < word_count * 2) {
+        table_size *= 2;
+    }
+
+    CHECK(vector_new(&word_table, sizeof(char*), 0));
+    CHECK(vector_append(&word_table, table_size, NULL));
+
+    for (size_t word_index = 0; word_index < word_count; ++ word_index) {
+        char* word = word_starts[word_index];
+        size_t slot = hash_word(word) & (table_size - 1);
+
+        while (word_table[slot] && (strcmp(word_table[slot], word) != 0)) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (! word_table[slot]) {
+            word_table[slot] = word;
+            word_starts[unique_count ++] = word;
+        }
+    }
+
+    qsort(word_starts, unique_count, sizeof(char*), compare_words);
+
+    // The old terms were copied into words, so they can be replaced.
+    string_free(&page->terms);
+    CHECK(string_new(&page->terms, 0));
+
+    for (size_t word_index = 0; word_index < unique_count; ++ word_index) {
+        CHECK(string_append(&page->terms, word_starts[word_index]));
+    }
+
+    FINALLY
+    if (word_table) {
+        vector_free(&word_table);
+    }
+
+    if (word_starts) {
+        vector_free(&word_starts);
+    }
+
+    string_free(&words);
+
+    RETURN;
+}
+
+// Every term of every page becomes a posting, and sorting the postings by term then page gives each
+// shard's lines in order. Shards whose contents are unchanged are left untouched on disk. The index
+// size and the number of pages in it are left in result.
+Status search_write_index(BuildResult* result, Site* site) {
+    TRY
+    char* search_path = NULL;
+    char* file_path = NULL;
+    char* pages_text = NULL;
+    Posting* postings = NULL;
+    uint doc_count = 0;
+
+    CHECK(string_path_join(&search_path, site->base_path, "search"));
+    CHECK(output_make_dir(site->output, search_path));
+    CHECK(string_new(&pages_text, 0));
+    CHECK(vector_new(&postings, sizeof(Posting), 0));
+
+    vector_foreach(site->pages, Page, page) {
+        if (! page->terms) {
+            continue;
+        }
+
+        CHECK(string_append(&pages_text, "/"));
+        CHECK(string_append(&pages_text, page->relative_url));
+        CHECK(string_append(&pages_text, " "));
+        CHECK(string_append(&pages_text, page->title));
+        CHECK(string_append(&pages_text, "\n"));
+
+        for (const char* term = page->terms; *term;) {
+            const char* term_end = strchr(term, '\n');
+            Posting posting = {term, term_end - term, doc_count};
+
+            CHECK(vector_append(&postings, 1, &posting));
+            term = term_end + 1;
+        }
+
+        ++ doc_count;
+    }
+
+    qsort(postings, vector_length(postings), sizeof(Posting), compare_postings);
+
+    CHECK(string_path_join(&file_path, search_path, "pages.txt"));
+    CHECK(output_write_changed(site->output, pages_text, file_path));
+
+    size_t index_size = string_length(pages_text);
+
+    CHECK(write_shards(&index_size, site->output, search_path, postings));
+
+    stats_count(SC_SearchBytes, index_size);
+    result->search_index_size = index_size;
+    result->search_page_count = doc_count;
+
+    FINALLY
+    if (postings) {
+        vector_free(&postings);
+    }
+
+    string_free(&pages_text);
+    string_free(&file_path);
+    string_free(&search_path);
+
+    RETURN;
+}
+
+// Adds the size of every shard to *index_size_p.
+static Status write_shards(size_t* index_size_p, Output* output, const char* search_path, Posting* postings) {
+    TRY
+    char* shard_text = NULL;
+    char* shard_path = NULL;
+    char line[LINE_SIZE];
+    size_t posting_index = 0;
+    size_t posting_count = vector_length(postings);
+
+    for (uint shard = 0; shard < strlen(SHARD_NAMES); ++ shard) {
+        const Posting* previous = NULL;
+
+        CHECK(string_new(&shard_text, 0));
+
+        while ((posting_index < posting_count) && (shard_index(postings[posting_index].term[0]) == shard)) {
+            const Posting* posting = &postings[posting_index];
+            uint shared_length = 0;
+
+            if (previous) {
+                while ((shared_length < MIN(previous->term_length, posting->term_length)) &&
+                    (previous->term[shared_length] == posting->term[shared_length]))
+                {
+                    ++ shared_length;
+                }
+            }
+
+            sprintf(line, "%u %.*s %u", shared_length, (int)(posting->term_length - shared_length),
+                &posting->term[shared_length], posting->doc_id);
+            CHECK(string_append(&shard_text, line));
+
+            uint last_doc_id = posting->doc_id;
+
+            for (++ posting_index; (posting_index < posting_count) && same_term(posting, &postings[posting_index]);
+                ++ posting_index)
+            {
+                sprintf(line, ",%u", postings[posting_index].doc_id - last_doc_id);
+                CHECK(string_append(&shard_text, line));
+                last_doc_id = postings[posting_index].doc_id;
+            }
+
+            CHECK(string_append(&shard_text, "\n"));
+            previous = posting;
+        }
+
+        CHECK(string_printf(&shard_path, "%s/%c.txt", search_path, SHARD_NAMES[shard]));
+        CHECK(output_write_changed(output, shard_text, shard_path));
+        *index_size_p += string_length(shard_text);
+
+        string_free(&shard_path);
+        string_free(&shard_text);
+    }
+
+    FINALLY
+    string_free(&shard_path);
+    string_free(&shard_text);
+
+    RETURN;
+}
+
+// Stores each word in length characters of Markdown source at *next_out_p, lower-cased and ending in
+// a newline, and adds its start to the list ending at *word_end_p. Words too short to search for are
+// dropped and overlong ones cut short.
+static void add_words(char*** word_end_p, char** next_out_p, const char* text, size_t length) {
+    char* word = *next_out_p;
+    uint word_length = 0;
+
+    for (size_t offset = 0; offset <= length; ++ offset) {
+        char next_char = (offset < length) ? text[offset] : ' ';
+
+        if ((next_char >= 'A') && (next_char <= 'Z')) {
+            next_char += 'a' - 'A';
+        }
+
+        if (((next_char >= 'a') && (next_char <= 'z')) || ((next_char >= '0') && (next_char <= '9'))) {
+            if (word_length < TERM_MAX_LENGTH) {
+                word[word_length ++] = next_char;
+            }
+        } else if (word_length > 0) {
+            if (word_length >= TERM_MIN_LENGTH) {
+                word[word_length] = '\n';
+                word[word_length + 1] = '\0';
+                *((*word_end_p) ++) = word;
+                word += word_length + 2;
+            }
+
+            word_length = 0;
+        }
+    }
+
+    *next_out_p = word;
+}
+
+// FNV-1a over the word up to its newline.
+static uint hash_word(const char* word) {
+    uint hash = 2166136261U;
+
+    for (; *word != '\n'; ++ word) {
+        hash = (hash ^ (unsigned char)*word) * 16777619U;
+    }
+
+    return hash;
+}
+
+// Code is not prose, and image captions are already described by the text around them.
+static bool is_prose(Page* page, size_t node_index) {
+    const Node* node = &page->nodes[node_index];
+
+    return (node->kind == NK_Text) && (node->type != ET_Preformatted) &&
+        (! ((node_index > 0) && (node[-1].kind == NK_Open) && (node[-1].type == ET_Image)));
+}
+
+static bool same_term(const Posting* posting1, const Posting* posting2) {
+    return (posting1->term_length == posting2->term_length) &&
+        (strncmp(posting1->term, posting2->term, posting1->term_length) == 0);
+}
+
+static uint shard_index(char first_char) {
+    return (first_char <= '9') ? 0 : (first_char - 'a' + 1);
+}
+
+// Orders by term, then by document ID within a term.
+static int compare_postings(const void* posting1_p, const void* posting2_p) {
+    const Posting* posting1 = posting1_p;
+    const Posting* posting2 = posting2_p;
+    int result = strncmp(posting1->term, posting2->term, MIN(posting1->term_length, posting2->term_length));
+
+    if (result == 0) {
+        result = (int)posting1->term_length - (int)posting2->term_length;
+    }
+
+    if (result == 0) {
+        result = (int)posting1->doc_id - (int)posting2->doc_id;
+    }
+
+    return result;
+}
+
+static int compare_words(const void* word1_p, const void* word2_p) {
+    return strcmp(*(char**)word1_p, *(char**)word2_p);
+}
@@ -0,0 +1,456 @@
+#include "common.h"
+
+#include <dos/dos.h>
+#include <proto/exec.h>
+#include <proto/socket.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define REQUEST_SIZE 2048
+#define LISTEN_BACKLOG 4
+
+typedef struct {
+    char* html;
+    time_t markdown_mtime;
+} CachedPage;
+
+static Status find_page(size_t* page_index_p, const char* url);
+static Status find_tag(size_t* tag_index_p, const char* url);
+static const char* get_content_type(const char* path);
+static Status handle_client(long client);
+static void invalidate_all(void);
+static Status load_pages(void);
+static Status refresh_template(void);
+static Status render_cached(const char** html_p, size_t page_index);
+static Status respond(long client, const char* target, bool head_only);
+static Status send_all(long client, const char* data, size_t size);
+static Status send_response(long client, const char* status, const char* content_type, const char* body,
+    size_t body_size, bool head_only);
+
+struct Library* SocketBase;
+
+// Pages are scanned once for their front matter and rendered the first time they are requested, then
+// again whenever their Markdown or the template changes. Nothing is written to BASEDIR.
+static struct {
+    Site* site;
+    char* template_path;
+    time_t template_mtime;
+    CachedPage* cache;
+} g;
+
+Status serve_run(Site* site, uint port) {
+    TRY
+    long listen_socket = -1;
+    struct sockaddr_in address = {0};
+    int reuse_address = 1;
+
+    g.site = site;
+
+    ASSERT(SocketBase = OpenLibrary("bsdsocket.library", 4), "Cannot open bsdsocket.library");
+    CHECK(string_path_join(&g.template_path, site->base_path, "page.html"));
+    CHECK(refresh_template());
+    CHECK(load_pages());
+
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    ASSERT((listen_socket = socket(AF_INET, SOCK_STREAM, 0)) >= 0, "Cannot create socket");
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+    ASSERT(bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) == 0, "Cannot listen on port %u", port);
+    ASSERT(listen(listen_socket, LISTEN_BACKLOG) == 0, "Cannot listen on port %u", port);
+
+    printf("Serving %s at http://localhost:%u/, press Ctrl-C to stop\n", site->base_path, port);
+
+    for (;;) {
+        fd_set read_set;
+        ULONG signals = SIGBREAKF_CTRL_C;
+
+        FD_ZERO(&read_set);
+        FD_SET(listen_socket, &read_set);
+
+        long ready = WaitSelect(listen_socket + 1, &read_set, NULL, NULL, NULL, &signals);
+
+        if (signals & SIGBREAKF_CTRL_C) {
+            break;
+        }
+
+        ASSERT(ready >= 0, "Error waiting for connections");
+
+        if (ready > 0) {
+            long client = accept(listen_socket, NULL, NULL);
+
+            if (client >= 0) {
+                // A page that fails to build is reported to the browser and the server carries on.
+                handle_client(client);
+                CloseSocket(client);
+            }
+        }
+    }
+
+    FINALLY
+    if (listen_socket >= 0) {
+        CloseSocket(listen_socket);
+    }
+
+    if (g.cache) {
+        vector_foreach(g.cache, CachedPage, cached) {
+            string_free(&cached->html);
+        }
+
+        vector_free(&g.cache);
+    }
+
+    string_free(&g.template_path);
+
+    if (SocketBase) {
+        CloseLibrary(SocketBase);
+        SocketBase = NULL;
+    }
+
+    RETURN;
+}
+
+static Status handle_client(long client) {
+    TRY
+    char request[REQUEST_SIZE + 1];
+    size_t request_size = 0;
+    char method[8];
+    char target[512];
+
+    // Only the request line matters, but the headers are read so the client sees a clean close.
+    while (request_size < REQUEST_SIZE) {
+        long received = recv(client, &request[request_size], REQUEST_SIZE - request_size, 0);
+
+        if (received <= 0) {
+            break;
+        }
+
+        request_size += received;
+        request[request_size] = '\0';
+
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+
+    request[request_size] = '\0';
+
+    if (sscanf(request, "%7s %511s", method, target) != 2) {
+        CHECK(send_response(client, "400 Bad Request", "text/plain", "Bad request\n", 12, false));
+        THROW(StatusOK);
+    }
+
+    bool head_only = (strcmp(method, "HEAD") == 0);
+
+    if ((! head_only) && (strcmp(method, "GET") != 0)) {
+        CHECK(send_response(client, "405 Method Not Allowed", "text/plain", "Method not allowed\n", 19, false));
+        THROW(StatusOK);
+    }
+
+    char* query = strchr(target, '?');
+
+    if (query) {
+        *query = '\0';
+    }
+
+    if (respond(client, target, head_only) != StatusOK) {
+        CHECK(send_response(client, "500 Internal Server Error", "text/plain", "Build failed\n", 13, head_only));
+    }
+
+    FINALLY RETURN;
+}
+
+static Status respond(long client, const char* target, bool head_only) {
+    TRY
+    char* text = NULL;
+    char* path = NULL;
+    PageViews views = {0};
+    struct stat path_stat;
+
+    // Targets are joined to BASEDIR, where on AmigaDOS a slash following another names the parent
+    // directory and a colon names another volume, so neither may lead outside it.
+    if ((target[0] != '/') || strstr(target, "..") || strstr(target, "//") || strchr(target, ':')) {
+        CHECK(send_response(client, "404 Not Found", "text/plain", "Not found\n", 10, head_only));
+        THROW(StatusOK);
+    }
+
+    CHECK(refresh_template());
+
+    if ((strcmp(target, "/") == 0) || (strcmp(target, "/index.html") == 0) || (strcmp(target, "/index.xml") == 0)) {
+        CHECK(views_build(&views, g.site->pages));
+
+        if (strcmp(target, "/index.xml") == 0) {
+            CHECK(rss_generate(&text, g.site->pages, &views, 0));
+            CHECK(send_response(client, "200 OK", "application/rss+xml", text, string_length(text), head_only));
+        } else {
+            CHECK(html_generate_root(&text, g.site, &views, vector_length(views.posts), 0));
+            CHECK(send_response(client, "200 OK", "text/html", text, string_length(text), head_only));
+        }
+
+        THROW(StatusOK);
+    }
+
+    if (string_startswith(target, "/tags/") && string_endswith(target, "/")) {
+        size_t tag_index;
+
+        CHECK(find_tag(&tag_index, target));
+
+        if (tag_index != HASH_NONE) {
+            Tag* tag = &g.site->tags[tag_index];
+
+            CHECK(views_sort_by_date(tag->page_indices, g.site->pages));
+            CHECK(html_generate_tag(&text, g.site, tag));
+            CHECK(send_response(client, "200 OK", "text/html", text, string_length(text), head_only));
+            THROW(StatusOK);
+        }
+    }
+
+    if (string_endswith(target, "/") || string_endswith(target, "/index.html")) {
+        size_t page_index;
+        const char* html = NULL;
+
+        CHECK(find_page(&page_index, target));
+
+        if (page_index == PAGE_INDEX_NONE) {
+            // The page may have been created since the last scan.
+            CHECK(load_pages());
+            CHECK(find_page(&page_index, target));
+        }
+
+        if (page_index != PAGE_INDEX_NONE) {
+            CHECK(render_cached(&html, page_index));
+            CHECK(send_response(client, "200 OK", "text/html", html, string_length(html), head_only));
+            THROW(StatusOK);
+        }
+    }
+
+    // Anything else, images included, is served straight from BASEDIR.
+    CHECK(string_path_join(&path, g.site->base_path, &target[1]));
+
+    if ((stat(path, &path_stat) != 0) || (! S_ISREG(path_stat.st_mode))) {
+        CHECK(send_response(client, "404 Not Found", "text/plain", "Not found\n", 10, head_only));
+        THROW(StatusOK);
+    }
+
+    CHECK(file_read(&text, path));
+    // Images contain NULs, so the size comes from the file rather than the string.
+    CHECK(send_response(client, "200 OK", get_content_type(path), text, path_stat.st_size, head_only));
+
+    FINALLY
+    if (views.projects) {
+        views_free(&views);
+    }
+
+    string_free(&path);
+    string_free(&text);
+
+    RETURN;
+}
+
+static Status find_page(size_t* page_index_p, const char* url) {
+    TRY
+    char* relative_url = NULL;
+    Page* pages = g.site->pages;
+
+    CHECK(string_clone(&relative_url, &url[1]));
+
+    if (string_endswith(relative_url, "index.html")) {
+        CHECK(string_truncate(&relative_url, string_length(relative_url) - strlen("index.html")));
+    }
+
+    *page_index_p = PAGE_INDEX_NONE;
+
+    for (size_t page_index = 0; page_index < vector_length(pages); ++ page_index) {
+        if (strcmp(pages[page_index].relative_url, relative_url) == 0) {
+            *page_index_p = page_index;
+            break;
+        }
+    }
+
+    FINALLY
+    string_free(&relative_url);
+
+    RETURN;
+}
+
+// Tags come from the front matter read by the last scan. Sets *tag_index_p to HASH_NONE when the URL
+// names no tag.
+static Status find_tag(size_t* tag_index_p, const char* url) {
+    TRY
+    char* slug = NULL;
+    size_t prefix_length = strlen("/tags/");
+
+    *tag_index_p = HASH_NONE;
+
+    if (strlen(url) <= prefix_length + 1) {
+        THROW(StatusOK);
+    }
+
+    CHECK(string_clone_substr(&slug, &url[prefix_length], strlen(url) - prefix_length - 1));
+    *tag_index_p = hash_map_find(&g.site->tag_map, slug);
+
+    FINALLY
+    string_free(&slug);
+
+    RETURN;
+}
+
+// Each ancestor whose Markdown changed is rendered again first, as that is what brings its title up to
+// date, and a changed title clears every page.
+static Status render_cached(const char** html_p, size_t page_index) {
+    TRY
+    char* html = NULL;
+    char* old_title = NULL;
+    const char* ancestor_html = NULL;
+    Page* pages = g.site->pages;
+    Page* page = &pages[page_index];
+    CachedPage* cached = &g.cache[page_index];
+    struct stat markdown_stat;
+
+    for (size_t index = page->parent_index; index != PAGE_INDEX_NONE; index = pages[index].parent_index) {
+        ASSERT(stat(pages[index].markdown_path, &markdown_stat) == 0, "Cannot stat %s", pages[index].markdown_path);
+
+        if (g.cache[index].markdown_mtime != markdown_stat.st_mtime) {
+            CHECK(render_cached(&ancestor_html, index));
+        }
+    }
+
+    ASSERT(stat(page->markdown_path, &markdown_stat) == 0, "Cannot stat %s", page->markdown_path);
+
+    if ((! cached->html) || (cached->markdown_mtime != markdown_stat.st_mtime)) {
+        CHECK(string_clone(&old_title, page->title));
+        CHECK(page_render(&html, g.site, page));
+
+        // Descendants carry this title in their own titles and breadcrumbs.
+        if (strcmp(old_title, page->title) != 0) {
+            invalidate_all();
+        }
+
+        string_free(&cached->html);
+        SWAP(cached->html, html);
+        cached->markdown_mtime = markdown_stat.st_mtime;
+    }
+
+    *html_p = cached->html;
+
+    FINALLY
+    string_free(&html);
+    string_free(&old_title);
+
+    RETURN;
+}
+
+static void invalidate_all(void) {
+    Page* pages = g.site->pages;
+
+    for (size_t page_index = 0; page_index < vector_length(pages); ++ page_index) {
+        string_free(&pages[page_index].full_title);
+        string_free(&pages[page_index].breadcrumb);
+        string_free(&g.cache[page_index].html);
+    }
+}
+
+static Status load_pages(void) {
+    TRY
+    if (g.cache) {
+        vector_foreach(g.cache, CachedPage, cached) {
+            string_free(&cached->html);
+        }
+
+        vector_free(&g.cache);
+    }
+
+    page_fini(g.site);
+    CHECK(page_init(g.site));
+    CHECK(page_scan_all(g.site));
+
+    CHECK(vector_new(&g.cache, sizeof(CachedPage), 0));
+    CHECK(vector_append(&g.cache, vector_length(g.site->pages), NULL));
+
+    // Titles are as the scan found them, so each page's date then tells when its title may have changed.
+    for (size_t page_index = 0; page_index < vector_length(g.site->pages); ++ page_index) {
+        struct stat markdown_stat;
+
+        if (stat(g.site->pages[page_index].markdown_path, &markdown_stat) == 0) {
+            g.cache[page_index].markdown_mtime = markdown_stat.st_mtime;
+        }
+    }
+
+    FINALLY RETURN;
+}
+
+static Status refresh_template(void) {
+    TRY
+    struct stat template_stat;
+
+    ASSERT(stat(g.template_path, &template_stat) == 0, "Cannot stat %s", g.template_path);
+
+    if (template_stat.st_mtime != g.template_mtime) {
+        html_fini(g.site);
+        CHECK(html_init(g.site));
+        g.template_mtime = template_stat.st_mtime;
+
+        if (g.cache) {
+            vector_foreach(g.cache, CachedPage, cached) {
+                string_free(&cached->html);
+            }
+        }
+    }
+
+    FINALLY RETURN;
+}
+
+static Status send_response(long client, const char* status, const char* content_type, const char* body,
+    size_t body_size, bool head_only)
+{
+    TRY
+    char* header = NULL;
+
+    CHECK(string_printf(&header, "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+        status, content_type, (unsigned long)body_size));
+    CHECK(send_all(client, header, string_length(header)));
+
+    if (! head_only) {
+        CHECK(send_all(client, body, body_size));
+    }
+
+    FINALLY
+    string_free(&header);
+
+    RETURN;
+}
+
+static Status send_all(long client, const char* data, size_t size) {
+    TRY
+    while (size > 0) {
+        long sent = send(client, data, size, 0);
+
+        ASSERT(sent > 0, "Error sending response");
+        data += sent;
+        size -= sent;
+    }
+
+    FINALLY RETURN;
+}
+
+static const char* get_content_type(const char* path) {
+    const char* types[][2] = {
+        {".html", "text/html"},
+        {".css",  "text/css"},
+        {".xml",  "application/rss+xml"},
+        {".png",  "image/png"},
+        {".jpg",  "image/jpeg"},
+        {".gif",  "image/gif"},
+        {".iff",  "image/x-ilbm"},
+    };
+
+    for (uint type = 0; type < sizeof(types) / sizeof(types[0]); ++ type) {
+        if (string_endswith(path, types[type][0])) {
+            return types[type][1];
+        }
+    }
+
+    return "application/octet-stream";
+}
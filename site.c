@@ -0,0 +1,74 @@
+#include "common.h"
+
+static size_t find_parent(Site* site, const char* relative_url);
+
+// A site holds its template, pages and cache settings. Programs embedding AGP link libagp.a, keep one
+// Site per task and never share it between tasks, and each task can render its own pages with
+// site_render or page_render. libagp.a leaves out the process-wide stats and tracing. Building to
+// disk goes through the Output in site->output, and sites sharing an Output, a cache directory or an
+// ImageCache must not use them from more than one task at a time.
+Status site_init(Site* site, const char* base_path, const char* cache_path) {
+    TRY
+    site->base_path = base_path;
+    site->cache_path = cache_path;
+
+    CHECK(html_init(site));
+    CHECK(cache_init(site));
+    CHECK(page_init(site));
+
+    FINALLY RETURN;
+}
+
+void site_fini(Site* site) {
+    page_fini(site);
+    cache_fini(site);
+    html_fini(site);
+}
+
+// Renders Markdown held in memory as the page at relative_url, e.g. "posts/first/". Nothing is read
+// but the template and any images it shows, and its ancestors are taken from pages already in the
+// site, as left by page_scan_all.
+Status site_render(char** page_html_p, Site* site, const char* markdown, const char* relative_url) {
+    TRY
+    Page page = {0};
+    const char* content = NULL;
+
+    CHECK(string_clone(&page.relative_url, relative_url));
+    CHECK(string_path_join(&page.dir_path, site->base_path, relative_url));
+    CHECK(string_clone(&page.source, markdown));
+    page.parent_index = find_parent(site, relative_url);
+
+    CHECK(markdown_parse_frontmatter(page.source, &page, &content));
+    // Front matter that is missing or never closed leaves the page undated.
+    ASSERT(page.date_key != 0, "Markdown must start with front matter");
+
+    CHECK(vector_new(&page.nodes, sizeof(Node), 0));
+    CHECK(markdown_parse_content(content, &page));
+    CHECK(html_generate(page_html_p, site, &page));
+
+    FINALLY
+    page_free(&page);
+
+    RETURN;
+}
+
+// The parent is the page with the longest URL that the page's own URL extends.
+static size_t find_parent(Site* site, const char* relative_url) {
+    size_t parent_index = PAGE_INDEX_NONE;
+    size_t parent_length = 0;
+    size_t url_length = strlen(relative_url);
+
+    for (size_t page_index = 0; page_index < vector_length(site->pages); ++ page_index) {
+        const char* page_url = site->pages[page_index].relative_url;
+        size_t page_length = strlen(page_url);
+
+        if ((page_length < url_length) && (strncmp(page_url, relative_url, page_length) == 0) &&
+            ((parent_index == PAGE_INDEX_NONE) || (page_length > parent_length)))
+        {
+            parent_index = page_index;
+            parent_length = page_length;
+        }
+    }
+
+    return parent_index;
+}
@@ -0,0 +1,248 @@
+#include "common.h"
+
+#include <time.h>
+
+#define STACK_DEPTH 8
+#define SLOW_PAGE_COUNT 10
+
+typedef struct {
+    char* path;
+    Ticks wall_ticks;
+} SlowPage;
+
+static void charge_stage(void);
+static Status write_json(const char* json_path);
+
+static const char* stage_names[SS_Count] = {
+    "tree_walk", "file_read", "markdown_parse_all", "html_generate",
+    "generate_image_tags", "file_write", "html_generate_root", "rss_generate", "search_index",
+};
+
+static const char* counter_names[SC_Count] = {
+    "pages_built", "pages_scanned", "bodies_cached", "nodes_cached", "tag_pages_built", "bytes_read",
+    "bytes_written", "elements", "images", "search_index_bytes",
+};
+
+static struct {
+    bool enabled;
+    Ticks mark_wall;
+    clock_t mark_cpu;
+    Ticks page_start;
+    Ticks stage_wall[SS_Count];
+    clock_t stage_cpu[SS_Count];
+    StatsStage stack[STACK_DEPTH];
+    uint depth;
+    size_t counters[SC_Count];
+    SlowPage slow_pages[SLOW_PAGE_COUNT];
+} g;
+
+Status stats_init(bool enabled) {
+    TRY
+    if (enabled) {
+        CHECK(eclock_init());
+
+        g.enabled = true;
+        g.mark_wall = eclock_read();
+        g.mark_cpu = clock();
+    }
+
+    FINALLY RETURN;
+}
+
+void stats_fini(void) {
+    if (g.enabled) {
+        for (uint i = 0; i < SLOW_PAGE_COUNT; ++ i) {
+            string_free(&g.slow_pages[i].path);
+        }
+
+        g.enabled = false;
+    }
+}
+
+// Stages nest, e.g. generate_image_tags inside html_generate. Time is charged to the innermost
+// open stage only, so the stage figures add up to the total without double counting. Stages also
+// appear as spans in --trace output.
+void stats_begin(StatsStage stage) {
+    trace_begin(stage_names[stage], NULL);
+
+    if (g.enabled) {
+        charge_stage();
+
+        if (g.depth < STACK_DEPTH) {
+            g.stack[g.depth] = stage;
+        }
+
+        ++ g.depth;
+    }
+}
+
+void stats_end(void) {
+    if (g.enabled) {
+        charge_stage();
+        -- g.depth;
+    }
+
+    trace_end();
+}
+
+void stats_count(StatsCounter counter, size_t amount) {
+    if (g.enabled) {
+        g.counters[counter] += amount;
+    }
+}
+
+// Allocations made outside any stage are charged to SS_Count.
+StatsStage stats_stage(void) {
+    return (g.depth > 0) ? g.stack[MIN(g.depth, STACK_DEPTH) - 1] : SS_Count;
+}
+
+void stats_page_begin(const char* path) {
+    trace_begin("build_page", path);
+
+    if (g.enabled) {
+        g.page_start = eclock_read();
+    }
+}
+
+Status stats_page_end(const char* path) {
+    TRY
+    if (g.enabled) {
+        Ticks wall_ticks = eclock_read() - g.page_start;
+        uint slot = SLOW_PAGE_COUNT;
+
+        while ((slot > 0) && (wall_ticks > g.slow_pages[slot - 1].wall_ticks)) {
+            -- slot;
+        }
+
+        if (slot < SLOW_PAGE_COUNT) {
+            string_free(&g.slow_pages[SLOW_PAGE_COUNT - 1].path);
+            memmove(&g.slow_pages[slot + 1], &g.slow_pages[slot], (SLOW_PAGE_COUNT - slot - 1) * sizeof(SlowPage));
+
+            g.slow_pages[slot].path = NULL;
+            g.slow_pages[slot].wall_ticks = wall_ticks;
+            CHECK(string_clone(&g.slow_pages[slot].path, path));
+        }
+    }
+
+    FINALLY
+    trace_end();
+
+    RETURN;
+}
+
+Status stats_report(const char* json_path) {
+    TRY
+    if (! g.enabled) {
+        THROW(StatusOK);
+    }
+
+    charge_stage();
+
+    Ticks total_wall = 0;
+    clock_t total_cpu = 0;
+
+    printf("%-22s %12s %12s %10s %10s %12s\n", "Stage", "Wall ms", "CPU ms", "Allocs", "Reallocs", "Copied KB");
+
+    for (uint stage = 0; stage < SS_Count; ++ stage) {
+        const AllocCounts* counts = alloc_counts(stage);
+
+        printf("%-22s %12.2f %12.2f %10lu %10lu %12lu\n", stage_names[stage], eclock_to_ms(g.stage_wall[stage]),
+            (g.stage_cpu[stage] * 1000.0) / CLOCKS_PER_SEC, (unsigned long)counts->allocs,
+            (unsigned long)counts->reallocs, (unsigned long)(counts->bytes_copied / 1024));
+
+        total_wall += g.stage_wall[stage];
+        total_cpu += g.stage_cpu[stage];
+    }
+
+    const AllocCounts* other_counts = alloc_counts(SS_Count);
+
+    printf("%-22s %12s %12s %10lu %10lu %12lu\n", "other", "", "", (unsigned long)other_counts->allocs,
+        (unsigned long)other_counts->reallocs, (unsigned long)(other_counts->bytes_copied / 1024));
+    printf("%-22s %12.2f %12.2f\n\n", "total", eclock_to_ms(total_wall), (total_cpu * 1000.0) / CLOCKS_PER_SEC);
+
+    for (uint counter = 0; counter < SC_Count; ++ counter) {
+        printf("%-22s %12lu\n", counter_names[counter], (unsigned long)g.counters[counter]);
+    }
+
+    printf("%-22s %12lu\n", "peak_memory_kb", (unsigned long)(memory_peak() / 1024));
+    printf("%-22s %12lu\n", "peak_heap_kb", (unsigned long)(alloc_peak() / 1024));
+
+    if (g.slow_pages[0].path) {
+        printf("\nSlowest pages (wall ms)\n");
+
+        for (uint i = 0; (i < SLOW_PAGE_COUNT) && g.slow_pages[i].path; ++ i) {
+            printf("%12.2f  %s\n", eclock_to_ms(g.slow_pages[i].wall_ticks), g.slow_pages[i].path);
+        }
+    }
+
+    if (json_path) {
+        CHECK(write_json(json_path));
+    }
+
+    FINALLY RETURN;
+}
+
+static Status write_json(const char* json_path) {
+    TRY
+    FILE* file = NULL;
+
+    ASSERT(file = fopen(json_path, "w"), "Error accessing file %s", json_path);
+
+    fprintf(file, "{\n  \"stages\": {\n");
+
+    for (uint stage = 0; stage < SS_Count; ++ stage) {
+        const AllocCounts* counts = alloc_counts(stage);
+
+        fprintf(file, "    \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"allocs\": %lu, \"reallocs\": %lu, "
+            "\"bytes_copied\": %lu},\n", stage_names[stage], eclock_to_ms(g.stage_wall[stage]),
+            (g.stage_cpu[stage] * 1000.0) / CLOCKS_PER_SEC, (unsigned long)counts->allocs,
+            (unsigned long)counts->reallocs, (unsigned long)counts->bytes_copied);
+    }
+
+    const AllocCounts* other_counts = alloc_counts(SS_Count);
+
+    fprintf(file, "    \"other\": {\"allocs\": %lu, \"reallocs\": %lu, \"bytes_copied\": %lu}\n",
+        (unsigned long)other_counts->allocs, (unsigned long)other_counts->reallocs,
+        (unsigned long)other_counts->bytes_copied);
+
+    fprintf(file, "  },\n  \"counters\": {\n");
+
+    for (uint counter = 0; counter < SC_Count; ++ counter) {
+        fprintf(file, "    \"%s\": %lu,\n", counter_names[counter], (unsigned long)g.counters[counter]);
+    }
+
+    fprintf(file, "    \"peak_memory_bytes\": %lu,\n", (unsigned long)memory_peak());
+    fprintf(file, "    \"peak_heap_bytes\": %lu\n  },\n  \"slowest_pages\": [", (unsigned long)alloc_peak());
+
+    for (uint i = 0; (i < SLOW_PAGE_COUNT) && g.slow_pages[i].path; ++ i) {
+        fprintf(file, "%s\n    {\"path\": ", (i > 0) ? "," : "");
+        json_write_string(file, g.slow_pages[i].path);
+        fprintf(file, ", \"wall_ms\": %.3f}", eclock_to_ms(g.slow_pages[i].wall_ticks));
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+
+    ASSERT(! ferror(file), "Error accessing file %s", json_path);
+
+    FINALLY
+    if (file) {
+        fclose(file);
+    }
+
+    RETURN;
+}
+
+static void charge_stage(void) {
+    Ticks now_wall = eclock_read();
+    clock_t now_cpu = clock();
+
+    if ((g.depth > 0) && (g.depth <= STACK_DEPTH)) {
+        StatsStage stage = g.stack[g.depth - 1];
+
+        g.stage_wall[stage] += now_wall - g.mark_wall;
+        g.stage_cpu[stage] += now_cpu - g.mark_cpu;
+    }
+
+    g.mark_wall = now_wall;
+    g.mark_cpu = now_cpu;
+}
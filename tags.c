@@ -0,0 +1,237 @@
+#include "common.h"
+
+#include <sys/stat.h>
+
+#define MANIFEST_NAME "tags"
+
+static Status load_manifest(HashMap* lines, char** manifest_p, const char* manifest_path);
+static Hash tag_signature(Site* site, Tag* tag, Hash template_hash);
+
+Status tags_init(Site* site) {
+    TRY
+    CHECK(vector_new(&site->tags, sizeof(Tag), 0));
+    CHECK(hash_map_init(&site->tag_map));
+
+    FINALLY RETURN;
+}
+
+void tags_fini(Site* site) {
+    if (site->tags) {
+        vector_foreach(site->tags, Tag, tag) {
+            string_free(&tag->name);
+            string_free(&tag->slug);
+
+            if (tag->page_indices) {
+                vector_free(&tag->page_indices);
+            }
+        }
+
+        vector_free(&site->tags);
+    }
+
+    hash_map_fini(&site->tag_map);
+}
+
+// Adds the page to the list of every tag in its front matter. site->tag_map maps each tag's slug to
+// its index in site->tags, so the index is built in the walk over the pages without searching it.
+// Tags differing only in case or punctuation share a page, named as they were first seen.
+Status tags_add_page(Site* site, size_t page_index) {
+    TRY
+    char* slug = NULL;
+    char** names = site->pages[page_index].tags;
+
+    if (! names) {
+        THROW(StatusOK);
+    }
+
+    vector_foreach(names, char*, name_p) {
+        CHECK(tags_make_slug(&slug, *name_p));
+
+        size_t tag_index = hash_map_find(&site->tag_map, slug);
+
+        if (tag_index == HASH_NONE) {
+            tag_index = vector_length(site->tags);
+            CHECK(vector_append(&site->tags, 1, NULL));
+
+            Tag* tag = &site->tags[tag_index];
+
+            CHECK(string_clone(&tag->name, *name_p));
+            SWAP(tag->slug, slug);
+            CHECK(vector_new(&tag->page_indices, sizeof(size_t), 0));
+            CHECK(hash_map_insert(&site->tag_map, tag->slug, tag_index));
+        }
+
+        size_t* page_indices = site->tags[tag_index].page_indices;
+
+        // Pages are added in turn, so a tag listed twice by one page ends its list already.
+        if ((vector_length(page_indices) == 0) || (vector_last(page_indices) != page_index)) {
+            CHECK(vector_append(&site->tags[tag_index].page_indices, 1, &page_index));
+        }
+
+        string_free(&slug);
+    }
+
+    FINALLY
+    string_free(&slug);
+
+    RETURN;
+}
+
+// Letters and digits are kept, lower-cased, and other ASCII characters become a hyphen. Latin-1
+// letters are lower-cased and written as two hex digits, so slugs stay plain ASCII in URLs while tags
+// such as "Café" and "Cafe" keep pages of their own.
+Status tags_make_slug(char** slug_p, const char* name) {
+    TRY
+    char slug_chars[3];
+
+    CHECK(string_new(slug_p, 0));
+
+    for (const unsigned char* next_char = (const unsigned char*)name; *next_char; ++ next_char) {
+        unsigned char name_char = *next_char;
+
+        if (((name_char >= 'A') && (name_char <= 'Z')) || ((name_char >= 0xC0) && (name_char <= 0xDE) && (name_char != 0xD7))) {
+            name_char += 'a' - 'A';
+        }
+
+        if (name_char >= 0x80) {
+            sprintf(slug_chars, "%02x", name_char);
+        } else if (((name_char >= 'a') && (name_char <= 'z')) || ((name_char >= '0') && (name_char <= '9'))) {
+            sprintf(slug_chars, "%c", name_char);
+        } else {
+            strcpy(slug_chars, "-");
+        }
+
+        CHECK(string_append(slug_p, slug_chars));
+    }
+
+    FINALLY RETURN;
+}
+
+// Writes BASEDIR/tags/<slug>/index.html for every tag. A tag page shows only the template and the URL,
+// title and date of each member, so a hash of those is kept for each tag in a manifest in the cache
+// directory, and a page whose hash is unchanged is left as it is on disk. Without a cache, or when
+// writing an archive, every tag page is written. The manifest also names the tags of the last build,
+// so the pages of tags no page carries any more are removed.
+Status tags_build_pages(Site* site) {
+    TRY
+    HashMap old_lines = {0};
+    char* old_manifest = NULL;
+    char* manifest = NULL;
+    char* manifest_path = NULL;
+    char* tags_path = NULL;
+    char* html_path = NULL;
+    char* text = NULL;
+    char* line = NULL;
+    struct stat path_stat;
+    Hash template_hash = hash_string(HASH_SEED, MANIFEST_NAME);
+
+    for (uint part = 0; part < TEMPLATE_PARTS; ++ part) {
+        template_hash = hash_string(template_hash, site->template_parts[part]);
+    }
+
+    CHECK(hash_map_init(&old_lines));
+    CHECK(cache_file_path(&manifest_path, site, MANIFEST_NAME));
+    CHECK(load_manifest(&old_lines, &old_manifest, manifest_path));
+
+    if ((vector_length(site->tags) == 0) && (old_lines.count == 0)) {
+        THROW(StatusOK);
+    }
+
+    CHECK(string_new(&manifest, 0));
+    CHECK(string_path_join(&tags_path, site->base_path, "tags"));
+    CHECK(output_make_dir(site->output, tags_path));
+
+    vector_foreach(site->tags, Tag, tag) {
+        CHECK(views_sort_by_date(tag->page_indices, site->pages));
+
+        Hash hash = tag_signature(site, tag, template_hash);
+
+        CHECK(string_printf(&line, "%08lx%08lx %s", (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFF),
+            tag->slug));
+        CHECK(string_path_join(&html_path, tags_path, tag->slug));
+        CHECK(output_make_dir(site->output, html_path));
+        CHECK(string_path_append(&html_path, "index.html"));
+
+        if ((hash_map_find(&old_lines, line) == HASH_NONE) || output_is_archive(site->output) ||
+            (stat(html_path, &path_stat) != 0))
+        {
+            CHECK(html_generate_tag(&text, site, tag));
+            CHECK(output_write(site->output, text, html_path));
+            stats_count(SC_TagPagesBuilt, 1);
+            string_free(&text);
+        }
+
+        CHECK(string_append(&manifest, line));
+        CHECK(string_append(&manifest, "\n"));
+
+        string_free(&html_path);
+        string_free(&line);
+    }
+
+    vector_foreach(old_lines.entries, HashEntry, entry) {
+        const char* slug = entry->key ? strchr(entry->key, ' ') : NULL;
+
+        if (slug && (slug[1] != '\0') && (hash_map_find(&site->tag_map, &slug[1]) == HASH_NONE)) {
+            CHECK(string_path_join(&html_path, tags_path, &slug[1]));
+            CHECK(output_remove_page(site->output, html_path));
+            string_free(&html_path);
+        }
+    }
+
+    if (manifest_path) {
+        CHECK(file_write(manifest, manifest_path));
+    }
+
+    FINALLY
+    string_free(&line);
+    string_free(&text);
+    string_free(&html_path);
+    string_free(&tags_path);
+    string_free(&manifest_path);
+    string_free(&manifest);
+    string_free(&old_manifest);
+    hash_map_fini(&old_lines);
+
+    RETURN;
+}
+
+// Fills lines with every line of the manifest written by the previous build, if there was one.
+static Status load_manifest(HashMap* lines, char** manifest_p, const char* manifest_path) {
+    TRY
+    struct stat path_stat;
+
+    if ((! manifest_path) || (stat(manifest_path, &path_stat) != 0)) {
+        THROW(StatusOK);
+    }
+
+    CHECK(file_read(manifest_p, manifest_path));
+
+    for (char* line = *manifest_p; *line;) {
+        char* line_end = strchr(line, '\n');
+
+        if (! line_end) {
+            break;
+        }
+
+        *line_end = '\0';
+        CHECK(hash_map_insert(lines, line, 0));
+        line = line_end + 1;
+    }
+
+    FINALLY RETURN;
+}
+
+// Covers everything html_generate_tag reads, with the members in the order they are listed.
+static Hash tag_signature(Site* site, Tag* tag, Hash template_hash) {
+    Hash hash = hash_string(template_hash, tag->name);
+
+    vector_foreach(tag->page_indices, size_t, page_index_p) {
+        Page* page = &site->pages[*page_index_p];
+
+        hash = hash_string(hash, page->relative_url);
+        hash = hash_string(hash, page->title);
+        hash = hash_string(hash, page->date);
+    }
+
+    return hash;
+}
@@ -0,0 +1,81 @@
+#include "common.h"
+
+#include <proto/exec.h>
+
+static void write_event(char phase, const char* name, const char* path);
+
+// Events are streamed to the file as they happen, so a build that fails part way still leaves a
+// trace that viewers will load up to the failure.
+static struct {
+    FILE* file;
+    const char* trace_path;
+    Ticks start;
+    bool first_event;
+} g;
+
+Status trace_init(const char* trace_path) {
+    TRY
+    if (trace_path) {
+        CHECK(eclock_init());
+        ASSERT(g.file = fopen(trace_path, "w"), "Error accessing file %s", trace_path);
+
+        g.trace_path = trace_path;
+        g.start = eclock_read();
+        g.first_event = true;
+
+        fprintf(g.file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    }
+
+    FINALLY RETURN;
+}
+
+void trace_fini(void) {
+    if (g.file) {
+        fclose(g.file);
+        g.file = NULL;
+    }
+}
+
+Status trace_close(void) {
+    TRY
+    if (g.file) {
+        fprintf(g.file, "\n]}\n");
+        ASSERT(! ferror(g.file), "Error accessing file %s", g.trace_path);
+        ASSERT(fclose(g.file) == 0, "Error accessing file %s", g.trace_path);
+        g.file = NULL;
+    }
+
+    FINALLY RETURN;
+}
+
+void trace_begin(const char* name, const char* path) {
+    if (g.file) {
+        write_event('B', name, path);
+    }
+}
+
+void trace_end(void) {
+    if (g.file) {
+        write_event('E', NULL, NULL);
+    }
+}
+
+static void write_event(char phase, const char* name, const char* path) {
+    double timestamp_us = eclock_to_ms(eclock_read() - g.start) * 1000.0;
+
+    fprintf(g.file, "%s\n{\"ph\": \"%c\", \"ts\": %.1f, \"pid\": 1, \"tid\": %lu", g.first_event ? "" : ",",
+        phase, timestamp_us, (unsigned long)FindTask(NULL));
+
+    if (name) {
+        fprintf(g.file, ", \"name\": \"%s\"", name);
+    }
+
+    if (path) {
+        fprintf(g.file, ", \"args\": {\"path\": ");
+        json_write_string(g.file, path);
+        fputc('}', g.file);
+    }
+
+    fputc('}', g.file);
+    g.first_event = false;
+}
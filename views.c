@@ -0,0 +1,105 @@
+#include "common.h"
+
+typedef int (*PageCompare)(const Page* page1, const Page* page2);
+
+static int date_compare(const Page* page1, const Page* page2);
+static Status sort_indices(size_t* indices, Page* pages, PageCompare compare);
+static int title_compare(const Page* page1, const Page* page2);
+
+Status views_build(PageViews* views, Page* pages) {
+    TRY
+    CHECK(vector_new(&views->projects, sizeof(size_t), 0));
+    CHECK(vector_new(&views->posts, sizeof(size_t), 0));
+    CHECK(vector_new(&views->feed_items, sizeof(size_t), 0));
+
+    for (size_t page_index = 0; page_index < vector_length(pages); ++ page_index) {
+        Page* page = &pages[page_index];
+
+        if (page->add_to_index) {
+            CHECK(vector_append(page->description ? &views->projects : &views->posts, 1, &page_index));
+        }
+
+        if (page->parent_index == PAGE_INDEX_NONE) {
+            CHECK(vector_append(&views->feed_items, 1, &page_index));
+        }
+    }
+
+    CHECK(sort_indices(views->projects, pages, title_compare));
+    CHECK(sort_indices(views->posts, pages, date_compare));
+    CHECK(sort_indices(views->feed_items, pages, date_compare));
+
+    FINALLY RETURN;
+}
+
+void views_free(PageViews* views) {
+    vector_free(&views->feed_items);
+    vector_free(&views->posts);
+    vector_free(&views->projects);
+}
+
+// Whether the first page comes before the second in the feed: newer, or as new and earlier in the
+// tree, as the stable sort in views_build leaves them.
+bool views_feed_precedes(Page* pages, size_t page_index1, size_t page_index2) {
+    int order = date_compare(&pages[page_index1], &pages[page_index2]);
+
+    return (order < 0) || ((order == 0) && (page_index1 < page_index2));
+}
+
+// Newest first, as posts are listed.
+Status views_sort_by_date(size_t* indices, Page* pages) {
+    TRY
+    CHECK(sort_indices(indices, pages, date_compare));
+
+    FINALLY RETURN;
+}
+
+static Status sort_indices(size_t* indices, Page* pages, PageCompare compare) {
+    TRY
+    size_t* merged = NULL;
+    size_t count = vector_length(indices);
+
+    CHECK(vector_new(&merged, sizeof(size_t), count));
+
+    // Bottom-up merge sort: stable, so pages that compare equal keep their tree order.
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t start = 0; start < count; start += 2 * width) {
+            size_t left = start;
+            size_t left_end = MIN(start + width, count);
+            size_t right = left_end;
+            size_t right_end = MIN(start + (2 * width), count);
+            size_t out = start;
+
+            while ((left < left_end) && (right < right_end)) {
+                if (compare(&pages[indices[right]], &pages[indices[left]]) < 0) {
+                    merged[out ++] = indices[right ++];
+                } else {
+                    merged[out ++] = indices[left ++];
+                }
+            }
+
+            while (left < left_end) {
+                merged[out ++] = indices[left ++];
+            }
+
+            while (right < right_end) {
+                merged[out ++] = indices[right ++];
+            }
+        }
+
+        memcpy(indices, merged, count * sizeof(size_t));
+    }
+
+    FINALLY
+    vector_free(&merged);
+
+    RETURN;
+}
+
+static int date_compare(const Page* page1, const Page* page2) {
+    // Newest first.
+    return (page1->date_key < page2->date_key) - (page1->date_key > page2->date_key);
+}
+
+static int title_compare(const Page* page1, const Page* page2) {
+    return strcmp(page1->title, page2->title);
+}